@@ -32,8 +32,11 @@
 #define BPGM_CLASSES(K) FOR_EACH_BPGM(pgm::BucketingPGMIndex, K)
 #define EFPGM_CLASSES(K) FOR_EACH_EPS(pgm::EliasFanoPGMIndex, K)
 #define CPGM_CLASSES(K) FOR_EACH_EPS(pgm::CompressedPGMIndex, K)
+#define SOAPGM_CLASSES(K) FOR_EACH_EPS(pgm::SoAPGMIndex, K)
+#define CAPGM_CLASSES(K) FOR_EACH_EPS(pgm::CacheAlignedPGMIndex, K)
 
-#define ALL_CLASSES(K) PGM_CLASSES(K), BPGM_CLASSES(K), EFPGM_CLASSES(K), CPGM_CLASSES(K)
+#define ALL_CLASSES(K) PGM_CLASSES(K), BPGM_CLASSES(K), EFPGM_CLASSES(K), CPGM_CLASSES(K), SOAPGM_CLASSES(K), \
+    CAPGM_CLASSES(K)
 
 template<typename K>
 void read_ints_helper(args::PositionalList<std::string> &files,
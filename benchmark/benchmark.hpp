@@ -15,6 +15,7 @@
 
 #pragma once
 
+#include "pgm/pgm_index.hpp"
 #include <sys/stat.h>
 #include <algorithm>
 #include <cassert>
@@ -217,9 +218,7 @@ benchmark(RandomIt begin, RandomIt end, const std::vector<typename RandomIt::val
     uint64_t cnt = 0;
     for (auto &q : queries) {
         auto range = index.search(q);
-        auto lo = begin + range.lo;
-        auto hi = begin + range.hi;
-        cnt += std::distance(begin, std::lower_bound(lo, hi, q));
+        cnt += std::distance(begin, pgm::lower_bound_in<Class::epsilon_value>(begin, range, q));
     }
     [[maybe_unused]] volatile auto tmp = cnt;
     auto t3 = timer::now();
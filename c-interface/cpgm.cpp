@@ -25,32 +25,10 @@
 
 #define EPSILON_RECURSIVE 4
 
-template<typename K>
-class PGMWrapper : public pgm::PGMIndex<K, 1, EPSILON_RECURSIVE> {
-    size_t epsilon;
-
-public:
-
-    PGMWrapper(const K *a, size_t n, size_t epsilon) : epsilon(epsilon) {
-        this->n = n;
-        this->first_key = n ? *a : 0;
-        this->build(a, a + n, epsilon, EPSILON_RECURSIVE, this->segments, this->levels_offsets);
-    }
-
-    approx_pos_t search(const K &key) const {
-        auto k = std::max(this->first_key, key);
-        auto it = this->segment_for_key(k);
-        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
-        auto lo = PGM_SUB_EPS(pos, epsilon);
-        auto hi = PGM_ADD_EPS(pos, epsilon, this->n);
-        return {pos, lo, hi};
-    }
-};
-
 #define PGM_INDEX_DEFINE(type)                                                                                         \
-    struct pgm_index_##type##_ : public PGMWrapper<PGM_T(type)> {                                                      \
+    struct pgm_index_##type##_ : public pgm::DynamicEpsilonPGMIndex<PGM_T(type)> {                                     \
         pgm_index_##type##_(const PGM_T(type) * a, size_t n, size_t epsilon)                                           \
-            : PGMWrapper<PGM_T(type)>(a, n, epsilon) {}                                                                \
+            : pgm::DynamicEpsilonPGMIndex<PGM_T(type)>(a, a + n, epsilon, EPSILON_RECURSIVE) {}                        \
     };                                                                                                                 \
                                                                                                                        \
     PGM_PTR(pgm_index, type)                                                                                           \
@@ -64,7 +42,10 @@ public:
                                                                                                                        \
     void pgm_index_##type##_destroy(PGM_PTR(pgm_index, type) pgm) { delete pgm; }                                      \
                                                                                                                        \
-    approx_pos_t pgm_index_##type##_search(PGM_PTR(pgm_index, type) pgm, PGM_T(type) q) { return pgm->search(q); }     \
+    approx_pos_t pgm_index_##type##_search(PGM_PTR(pgm_index, type) pgm, PGM_T(type) q) {                             \
+        auto range = pgm->search(q);                                                                                   \
+        return {range.pos, range.lo, range.hi};                                                                        \
+    }                                                                                                                  \
                                                                                                                        \
     size_t pgm_index_##type##_size_in_bytes(PGM_PTR(pgm_index, type) pgm) { return pgm->size_in_bytes(); }
 
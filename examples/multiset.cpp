@@ -23,13 +23,12 @@ public:
     explicit PGMMultiset(const std::vector<K> &data) : data(data), pgm(data.begin(), data.end()) {}
 
     bool contains(const K x) const {
-        auto range = pgm.search(x);
-        return std::binary_search(data.begin() + range.lo, data.begin() + range.hi, x);
+        auto it = lower_bound(x);
+        return it != end() && *it == x;
     }
 
     auto lower_bound(const K x) const {
-        auto range = pgm.search(x);
-        return std::lower_bound(data.begin() + range.lo, data.begin() + range.hi, x);
+        return pgm::lower_bound_in<decltype(pgm)::epsilon_value>(data.begin(), pgm.search(x), x);
     }
 
     auto upper_bound(const K x) const {
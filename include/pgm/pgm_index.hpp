@@ -16,15 +16,30 @@
 #pragma once
 
 #include "piecewise_linear_model.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <algorithm>
+#include <cerrno>
+#include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <iterator>
 #include <limits>
+#include <memory>
 #include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
 namespace pgm {
 
 #define PGM_SUB_EPS(x, epsilon) ((x) <= (epsilon) ? 0 : ((x) - (epsilon)))
@@ -40,6 +55,584 @@ struct ApproxPos {
     size_t hi;  ///< The upper bound of the range.
 };
 
+/**
+ * The counters of the events of the searches of an index, collected when its instrumentation policy is enabled.
+ */
+struct LookupCounters {
+    size_t searches = 0;         ///< The number of searches.
+    size_t levels = 0;           ///< The number of levels searched for the responsible segments, below the root.
+    size_t segments_scanned = 0; ///< The number of segments compared in those levels.
+    size_t window = 0;           ///< The total size of the returned search ranges.
+    size_t clipped = 0;          ///< The number of predictions clipped by the intercept of the next segment.
+
+    LookupCounters &operator+=(const LookupCounters &o) {
+        searches += o.searches;
+        levels += o.levels;
+        segments_scanned += o.segments_scanned;
+        window += o.window;
+        clipped += o.clipped;
+        return *this;
+    }
+
+    friend LookupCounters operator-(LookupCounters a, const LookupCounters &b) {
+        a.searches -= b.searches;
+        a.levels -= b.levels;
+        a.segments_scanned -= b.segments_scanned;
+        a.window -= b.window;
+        a.clipped -= b.clipped;
+        return a;
+    }
+};
+
+/**
+ * The default instrumentation policy of the indexes, which records nothing, so that the instrumentation is compiled
+ * out of the searches.
+ */
+struct NoInstrumentation {
+    static constexpr bool enabled = false;
+};
+
+/**
+ * An instrumentation policy that adds the events of the searches to @ref LookupCounters local to the calling thread.
+ * The events of a single search are the difference between the counters after and before it.
+ *
+ * A custom policy has the same members: a constexpr @c enabled flag and a static @c counters() function returning
+ * the @ref LookupCounters to update.
+ */
+struct CountingInstrumentation {
+    static constexpr bool enabled = true;
+
+    /** Returns the counters of the calling thread. */
+    static LookupCounters &counters() {
+        thread_local LookupCounters c;
+        return c;
+    }
+};
+
+#pragma pack(push, 1)
+
+/**
+ * A fixed-point number that can be used in place of @c float or @c double as the type of the slopes of a
+ * @ref PGMIndex on integer keys.
+ *
+ * The slope is stored as a 64-bit mantissa and a shift, that is, as the value <tt>mantissa / 2^shift</tt>. Multiplying
+ * it by a key difference takes a 64x64-bit multiply and a shift, without int-to-float conversions, and the result is
+ * exact for any offset within a segment, whereas a @c float slope loses precision past 2^24 positions.
+ */
+struct FixedPoint {
+    uint64_t mantissa; ///< The significant bits of the value.
+    uint8_t shift;     ///< The number of fractional bits of mantissa.
+
+    FixedPoint() = default;
+
+    FixedPoint(long double x) : mantissa(0), shift(0) {
+        if (x <= 0)
+            return;
+        int exponent;
+        auto fraction = std::frexp(x, &exponent); // x = fraction * 2^exponent, with fraction in [0.5, 1)
+        auto s = 64 - exponent;
+        if (s < 0)
+            throw std::overflow_error("FixedPoint cannot represent the given value");
+        if (s > 127)
+            return; // Smaller than 2^-64, rounds to zero
+        mantissa = uint64_t(std::ldexp(fraction, 64));
+        shift = uint8_t(s);
+    }
+
+    bool operator==(const FixedPoint &f) const { return mantissa == f.mantissa && shift == f.shift; }
+
+    bool operator!=(const FixedPoint &f) const { return !(*this == f); }
+
+    /**
+     * Returns the integer part of the product of this number with a non-negative integer.
+     * @param dx the integer to multiply
+     * @return the product rounded towards zero
+     */
+    template<typename T>
+    int64_t operator*(const T &dx) const {
+        static_assert(std::is_integral_v<T>, "FixedPoint slopes require integer keys");
+        auto product = (unsigned __int128) mantissa * std::make_unsigned_t<T>(dx);
+        return int64_t(product >> shift);
+    }
+
+    explicit operator long double() const { return std::ldexp((long double) mantissa, -int(shift)); }
+};
+
+#pragma pack(pop)
+
+/**
+ * A reader of a binary file containing a sequence of numbers of type @p K with the same endianness of the CPU.
+ *
+ * The file is read sequentially, one chunk at a time, through an input iterator. This allows building an index in a
+ * single pass on a file much larger than the memory, e.g. <tt>PGMIndex<K> index(reader.begin(), reader.end())</tt>.
+ *
+ * @tparam K the type of the numbers in the file
+ */
+template<typename K>
+class BinaryFileReader {
+    std::ifstream in;     ///< The file being read.
+    std::vector<K> chunk; ///< The chunk of the file being read.
+    size_t chunk_size;    ///< The number of elements in the chunk.
+    size_t pos;           ///< The position in the chunk of the current element.
+    size_t n;             ///< The number of elements in the file.
+
+    bool read_chunk() {
+        in.read((char *) chunk.data(), chunk.size() * sizeof(K));
+        chunk_size = size_t(in.gcount()) / sizeof(K);
+        pos = 0;
+        return chunk_size > 0;
+    }
+
+public:
+
+    class iterator {
+        BinaryFileReader *reader; ///< The reader, or nullptr if this is the end iterator.
+
+    public:
+
+        using iterator_category = std::input_iterator_tag;
+        using value_type = K;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const K *;
+        using reference = const K &;
+
+        explicit iterator(BinaryFileReader *reader = nullptr) : reader(reader) {}
+
+        reference operator*() const { return reader->chunk[reader->pos]; }
+
+        pointer operator->() const { return &**this; }
+
+        iterator &operator++() {
+            if (++reader->pos == reader->chunk_size && !reader->read_chunk())
+                reader = nullptr;
+            return *this;
+        }
+
+        bool operator==(const iterator &other) const { return reader == other.reader; }
+
+        bool operator!=(const iterator &other) const { return reader != other.reader; }
+    };
+
+    /**
+     * Opens the given file for reading.
+     * @param path the path of the file to read
+     * @param chunk_elements the number of elements read from the file at a time
+     */
+    explicit BinaryFileReader(const std::string &path, size_t chunk_elements = 1u << 16)
+        : in(path, std::ios::in | std::ios::binary),
+          chunk(std::max<size_t>(chunk_elements, 1)),
+          chunk_size(0),
+          pos(0),
+          n(0) {
+        if (!in)
+            throw std::runtime_error("Open file error " + path);
+        in.seekg(0, std::ios::end);
+        auto bytes = size_t(in.tellg());
+        in.seekg(0);
+        if (bytes % sizeof(K) != 0)
+            throw std::runtime_error("Input file size must be a multiple of " + std::to_string(sizeof(K)) + " bytes.");
+        n = bytes / sizeof(K);
+    }
+
+    /**
+     * Returns an iterator to the first element of the file. Since the file is read sequentially, this function should
+     * be called only once.
+     * @return an iterator to the first element of the file
+     */
+    iterator begin() { return iterator(read_chunk() ? this : nullptr); }
+
+    /**
+     * Returns an iterator to the element following the last element of the file.
+     * @return an iterator to the element following the last element of the file
+     */
+    iterator end() { return iterator(); }
+
+    /**
+     * Returns the number of elements in the file.
+     * @return the number of elements in the file
+     */
+    size_t size() const { return n; }
+};
+
+namespace internal {
+
+/** Returns true iff @p RandomIt is known to point into contiguous storage of trivially comparable numbers. */
+template<typename RandomIt>
+constexpr bool is_simd_searchable() {
+    using T = typename std::iterator_traits<RandomIt>::value_type;
+    constexpr bool contiguous = std::is_pointer_v<RandomIt>
+        || std::is_same_v<RandomIt, typename std::vector<T>::iterator>
+        || std::is_same_v<RandomIt, typename std::vector<T>::const_iterator>;
+    return contiguous && std::is_arithmetic_v<T> && !std::is_same_v<T, bool> && (sizeof(T) == 4 || sizeof(T) == 8);
+}
+
+/**
+ * Returns the number of elements in [p, p + n) that are less than @p key or, if @p Inclusive is true, that are less
+ * than or equal to @p key. On sorted data, this is the offset of the lower bound (resp. upper bound) of @p key.
+ *
+ * The count is computed without branches on the data, using AVX-512 or AVX2 compare-and-popcount kernels when
+ * available, and a scalar loop otherwise.
+ */
+template<bool Inclusive = false, typename T>
+size_t count_less(const T *p, size_t n, T key) {
+    size_t count = 0;
+    size_t i = 0;
+
+    if constexpr (std::is_arithmetic_v<T> && (sizeof(T) == 4 || sizeof(T) == 8)) {
+#if defined(__AVX512F__)
+        constexpr auto lanes = 64 / sizeof(T);
+        auto cmp = [&](auto v, auto mask) -> size_t {
+            constexpr int op = Inclusive ? _MM_CMPINT_LE : _MM_CMPINT_LT;
+            if constexpr (std::is_same_v<T, float>)
+                return __builtin_popcount(_mm512_mask_cmp_ps_mask(mask, v, _mm512_set1_ps(key),
+                                                                  Inclusive ? _CMP_LE_OQ : _CMP_LT_OQ));
+            else if constexpr (std::is_same_v<T, double>)
+                return __builtin_popcount(_mm512_mask_cmp_pd_mask(mask, v, _mm512_set1_pd(key),
+                                                                  Inclusive ? _CMP_LE_OQ : _CMP_LT_OQ));
+            else if constexpr (sizeof(T) == 4 && std::is_signed_v<T>)
+                return __builtin_popcount(_mm512_mask_cmp_epi32_mask(mask, v, _mm512_set1_epi32(key), op));
+            else if constexpr (sizeof(T) == 4)
+                return __builtin_popcount(_mm512_mask_cmp_epu32_mask(mask, v, _mm512_set1_epi32(key), op));
+            else if constexpr (std::is_signed_v<T>)
+                return __builtin_popcount(_mm512_mask_cmp_epi64_mask(mask, v, _mm512_set1_epi64(key), op));
+            else
+                return __builtin_popcount(_mm512_mask_cmp_epu64_mask(mask, v, _mm512_set1_epi64(key), op));
+        };
+        auto load = [&](const T *ptr, auto mask) {
+            if constexpr (std::is_same_v<T, float>)
+                return _mm512_maskz_loadu_ps(mask, ptr);
+            else if constexpr (std::is_same_v<T, double>)
+                return _mm512_maskz_loadu_pd(mask, ptr);
+            else if constexpr (sizeof(T) == 4)
+                return _mm512_maskz_loadu_epi32(mask, ptr);
+            else
+                return _mm512_maskz_loadu_epi64(mask, ptr);
+        };
+        using mask_type = std::conditional_t<lanes == 16, __mmask16, __mmask8>;
+        for (; i + lanes <= n; i += lanes)
+            count += cmp(load(p + i, mask_type(~0u)), mask_type(~0u));
+        if (i < n) {
+            auto mask = mask_type((1u << (n - i)) - 1);
+            count += cmp(load(p + i, mask), mask);
+        }
+        return count;
+#elif defined(__AVX2__)
+        constexpr auto lanes = 32 / sizeof(T);
+        for (; i + lanes <= n; i += lanes) {
+            int mask;
+            if constexpr (std::is_same_v<T, float>) {
+                auto v = _mm256_loadu_ps(p + i);
+                mask = _mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_set1_ps(key), Inclusive ? _CMP_LE_OQ : _CMP_LT_OQ));
+            } else if constexpr (std::is_same_v<T, double>) {
+                auto v = _mm256_loadu_pd(p + i);
+                mask = _mm256_movemask_pd(_mm256_cmp_pd(v, _mm256_set1_pd(key), Inclusive ? _CMP_LE_OQ : _CMP_LT_OQ));
+            } else {
+                // AVX2 only has signed comparisons: flip the sign bit of unsigned values to preserve their order
+                constexpr auto flip = std::is_signed_v<T> ? T(0) : T(1) << (sizeof(T) * 8 - 1);
+                auto v = _mm256_loadu_si256((const __m256i *) (p + i));
+                __m256i k, gt;
+                if constexpr (sizeof(T) == 4) {
+                    v = _mm256_xor_si256(v, _mm256_set1_epi32(flip));
+                    k = _mm256_set1_epi32(key ^ flip);
+                    gt = Inclusive ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v);
+                } else {
+                    v = _mm256_xor_si256(v, _mm256_set1_epi64x(flip));
+                    k = _mm256_set1_epi64x(key ^ flip);
+                    gt = Inclusive ? _mm256_cmpgt_epi64(v, k) : _mm256_cmpgt_epi64(k, v);
+                }
+                mask = sizeof(T) == 4 ? _mm256_movemask_ps(_mm256_castsi256_ps(gt))
+                                      : _mm256_movemask_pd(_mm256_castsi256_pd(gt));
+                if constexpr (Inclusive)
+                    mask = ~mask & ((1 << lanes) - 1); // v <= k iff !(v > k)
+            }
+            count += __builtin_popcount(mask);
+        }
+#endif
+    }
+
+    for (; i < n; ++i)
+        count += Inclusive ? !(key < p[i]) : p[i] < key;
+    return count;
+}
+
+/**
+ * Maps the first @p bytes of the file at @p path in memory, read-only.
+ * @param path the path of the file to map
+ * @param bytes the number of bytes to map, must be positive
+ * @return a pointer to the mapping, which is unmapped when the last copy of the pointer is destroyed
+ */
+inline std::shared_ptr<const void> map_file(const std::string &path, size_t bytes) {
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::runtime_error("Open file error " + std::string(strerror(errno)));
+
+    auto data = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    auto error = errno;
+    close(fd);
+    if (data == MAP_FAILED)
+        throw std::runtime_error("mmap error " + std::string(strerror(error)));
+
+    return {data, [bytes](const void *p) { munmap(const_cast<void *>(p), bytes); }};
+}
+
+/**
+ * A read-only array that either owns its elements or refers to elements stored in a memory mapping, so that an index
+ * loaded from a file can use its arrays in place.
+ */
+template<typename T>
+class MappableArray {
+    std::vector<T> owned;             ///< The elements, if they are owned by the array.
+    const T *first = nullptr;         ///< The first element, either in owned or in the mapping.
+    size_t count = 0;                 ///< The number of elements.
+    std::shared_ptr<const void> file; ///< The mapping containing the elements, if they are not owned.
+
+public:
+
+    using value_type = T;
+    using const_iterator = const T *;
+
+    MappableArray() = default;
+
+    MappableArray(std::vector<T> &&elements) : owned(std::move(elements)), first(owned.data()), count(owned.size()) {}
+
+    MappableArray(const T *first, size_t count, std::shared_ptr<const void> file)
+        : owned(), first(first), count(count), file(std::move(file)) {}
+
+    MappableArray(const MappableArray &a)
+        : owned(a.owned), first(a.file ? a.first : owned.data()), count(a.count), file(a.file) {}
+
+    MappableArray(MappableArray &&a) noexcept
+        : owned(std::move(a.owned)), first(a.file ? a.first : owned.data()), count(a.count), file(std::move(a.file)) {}
+
+    MappableArray &operator=(MappableArray a) noexcept {
+        owned.swap(a.owned); // Swapping vectors preserves the addresses of their elements
+        std::swap(first, a.first);
+        std::swap(count, a.count);
+        file.swap(a.file);
+        return *this;
+    }
+
+    /** Returns true iff the elements are stored in a memory mapping rather than owned by the array. */
+    bool is_mapped() const { return file != nullptr; }
+
+    const T *data() const { return first; }
+    const T *begin() const { return first; }
+    const T *end() const { return first + count; }
+    const T *cbegin() const { return first; }
+    const T *cend() const { return first + count; }
+    const T &operator[](size_t i) const { return first[i]; }
+    const T &front() const { return first[0]; }
+    const T &back() const { return first[count - 1]; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+/**
+ * Calls @p f with a @c std::integral_constant equal to @p epsilon if @p epsilon is a power of two not greater than
+ * 4096, or equal to zero otherwise. This turns a runtime epsilon into a template argument for the common values.
+ * @param epsilon the runtime value of epsilon
+ * @param f a generic callable that takes a @c std::integral_constant<size_t, E>
+ * @return the value returned by @p f
+ */
+template<typename F>
+decltype(auto) dispatch_epsilon(size_t epsilon, F f) {
+    switch (epsilon) {
+        case 1: return f(std::integral_constant<size_t, 1>{});
+        case 2: return f(std::integral_constant<size_t, 2>{});
+        case 4: return f(std::integral_constant<size_t, 4>{});
+        case 8: return f(std::integral_constant<size_t, 8>{});
+        case 16: return f(std::integral_constant<size_t, 16>{});
+        case 32: return f(std::integral_constant<size_t, 32>{});
+        case 64: return f(std::integral_constant<size_t, 64>{});
+        case 128: return f(std::integral_constant<size_t, 128>{});
+        case 256: return f(std::integral_constant<size_t, 256>{});
+        case 512: return f(std::integral_constant<size_t, 512>{});
+        case 1024: return f(std::integral_constant<size_t, 1024>{});
+        case 2048: return f(std::integral_constant<size_t, 2048>{});
+        case 4096: return f(std::integral_constant<size_t, 4096>{});
+        default: return f(std::integral_constant<size_t, 0>{});
+    }
+}
+
+template<typename It, typename = void>
+struct has_base : std::false_type {};
+
+template<typename It>
+struct has_base<It, std::void_t<decltype(std::declval<It>().base())>> : std::true_type {};
+
+/**
+ * Prefetches the element pointed to by @p it. If the element is computed on the fly, as by a @ref ProjectionIterator,
+ * the element it is computed from is prefetched instead.
+ */
+template<typename It>
+inline void prefetch(It it) {
+    if constexpr (std::is_lvalue_reference_v<typename std::iterator_traits<It>::reference>)
+        __builtin_prefetch(&*it, 0, 0);
+    else if constexpr (has_base<It>::value)
+        prefetch(it.base());
+}
+
+/** Calls @p f on the counters of @p Instrumentation, only if the policy is enabled. */
+template<typename Instrumentation, typename F>
+inline void record(F f) {
+    if constexpr (Instrumentation::enabled)
+        f(Instrumentation::counters());
+}
+
+/** Returns the number of segments a binary search on @p n segments compares in the worst case, ceil(log2(n + 1)). */
+inline size_t binary_search_probes(size_t n) { return n == 0 ? 0 : 64 - __builtin_clzll(n); }
+
+/**
+ * The instrumentation policy of an index searched inside another one, such as the index on the keys of the segments
+ * of a variant. Its events are kept apart, so that @ref record_nested adds them to the outer index as the levels it
+ * searched, rather than as searches of their own.
+ */
+template<typename Instrumentation>
+struct NestedInstrumentation {
+    static constexpr bool enabled = Instrumentation::enabled;
+
+    static LookupCounters &counters() {
+        thread_local LookupCounters c;
+        return c;
+    }
+};
+
+/** Moves the levels searched by an index with policy NestedInstrumentation<Instrumentation> to @p Instrumentation. */
+template<typename Instrumentation>
+inline void record_nested() {
+    record<Instrumentation>([](auto &c) {
+        auto &nested = NestedInstrumentation<Instrumentation>::counters();
+        c.levels += nested.levels;
+        c.segments_scanned += nested.segments_scanned;
+        c.clipped += nested.clipped;
+        nested = LookupCounters();
+    });
+}
+
+/**
+ * Returns the position predicted for @p key by the segment @p it, clipped to the intercept of the next segment.
+ * @param it the segment responsible for @p key
+ * @param key the value of the element to search for
+ * @return the predicted position
+ */
+template<typename Instrumentation, typename SegmentIt, typename K>
+size_t predict(SegmentIt it, const K &key) {
+    auto pos = (*it)(key);
+    size_t bound = std::next(it)->intercept;
+    record<Instrumentation>([&](auto &c) { c.clipped += pos > bound; });
+    return std::min(pos, bound);
+}
+
+/**
+ * Returns the rightmost segment having key <= the sought key among those of a level around the position @p pos
+ * predicted by the level above. The window is scanned linearly if it is known at compile time to span a few cache
+ * lines, otherwise it is binary searched.
+ * @tparam EpsilonRecursive the epsilon of the level, or 0 if it is known only at runtime
+ * @param level_begin the first segment of the level
+ * @param level_size the number of segments of the level, excluding the sentinel
+ * @param pos the position predicted by the level above
+ * @param epsilon_recursive the epsilon of the level, which is equal to @p EpsilonRecursive if that is not 0
+ * @param key the value of the element to search for
+ * @return an iterator to the segment responsible for the given key in the level
+ */
+template<size_t EpsilonRecursive, typename Instrumentation, typename SegmentIt, typename K>
+SegmentIt segment_in_level(SegmentIt level_begin, size_t level_size, size_t pos, size_t epsilon_recursive,
+                           const K &key) {
+    using Segment = typename std::iterator_traits<SegmentIt>::value_type;
+    auto lo = level_begin + PGM_SUB_EPS(pos, epsilon_recursive + 1);
+
+    static constexpr size_t linear_search_threshold = 8 * 64 / sizeof(Segment);
+    if constexpr (EpsilonRecursive != 0 && EpsilonRecursive <= linear_search_threshold) {
+        auto start = lo;
+        for (; std::next(lo)->key <= key; ++lo)
+            continue;
+        record<Instrumentation>([&](auto &c) {
+            ++c.levels;
+            c.segments_scanned += std::distance(start, lo) + 1;
+        });
+        return lo;
+    } else {
+        auto hi = level_begin + PGM_ADD_EPS(pos, epsilon_recursive, level_size);
+        record<Instrumentation>([&](auto &c) {
+            ++c.levels;
+            c.segments_scanned += binary_search_probes(std::distance(lo, hi));
+        });
+        return std::prev(std::upper_bound(lo, hi, key));
+    }
+}
+
+/**
+ * Returns the segment responsible for a given key in the last level of a recursive index, by descending its levels
+ * from the root with @ref segment_in_level.
+ * @tparam EpsilonRecursive the epsilon of the internal levels, or 0 if it is known only at runtime
+ * @param segments the first segment of the index, whose levels are stored from the last one upwards
+ * @param levels_offsets the starting position of each level in @p segments, followed by the end of the root
+ * @param epsilon_recursive the epsilon of the internal levels, which is equal to @p EpsilonRecursive if that is not 0
+ * @param key the value of the element to search for
+ * @return an iterator to the segment responsible for the given key
+ */
+template<size_t EpsilonRecursive, typename Instrumentation, typename SegmentIt, typename K>
+SegmentIt segment_in_levels(SegmentIt segments, const std::vector<size_t> &levels_offsets, size_t epsilon_recursive,
+                            const K &key) {
+    auto it = segments + *(levels_offsets.end() - 2);
+    for (auto l = int(levels_offsets.size()) - 3; l >= 0; --l) {
+        auto level_size = levels_offsets[l + 1] - levels_offsets[l] - 1;
+        auto pos = predict<Instrumentation>(it, key);
+        it = segment_in_level<EpsilonRecursive, Instrumentation>(segments + levels_offsets[l], level_size, pos,
+                                                                 epsilon_recursive, key);
+    }
+    return it;
+}
+
+} // namespace internal
+
+/**
+ * Returns an iterator pointing to the first element in the range [data + range.lo, data + range.hi) that is not less
+ * than (i.e. greater or equal to) @p key, or data + range.hi if no such element is found.
+ *
+ * This is meant to complete a lookup after a call to the @c search method of an index built on @p data, and it is
+ * equivalent to <tt>std::lower_bound(data + range.lo, data + range.hi, key)</tt>. The range is first narrowed with a
+ * branchless binary search, and then the final few cache lines are scanned with a branchless SIMD count. If the
+ * @p Epsilon of the index is given, the window size is known at compile time, and for small values of @p Epsilon the
+ * binary search is skipped entirely.
+ *
+ * @tparam Epsilon the @c epsilon_value of the index that returned @p range, or 0 if not known
+ * @param data an iterator to the beginning of the sorted data on which the index was built
+ * @param range the range returned by the index
+ * @param key the value to compare the elements to
+ * @return an iterator to the first element in the range that is not less than @p key
+ */
+template<size_t Epsilon = 0, typename RandomIt, typename K>
+RandomIt lower_bound_in(RandomIt data, const ApproxPos &range, const K &key) {
+    using T = typename std::iterator_traits<RandomIt>::value_type;
+    auto first = data + range.lo;
+    auto n = range.hi > range.lo ? range.hi - range.lo : 0;
+
+    constexpr size_t linear_search_threshold = 8 * 64 / sizeof(T);
+    constexpr bool binary_search_needed = Epsilon == 0 || 2 * Epsilon + 3 > linear_search_threshold;
+    if constexpr (binary_search_needed) {
+        while (n > linear_search_threshold) {
+            auto half = n / 2;
+            internal::prefetch(first + half / 2);
+            internal::prefetch(first + half + half / 2);
+            first = first[half] < key ? first + half : first;
+            n -= half;
+        }
+    }
+
+    if (n == 0)
+        return first;
+    if constexpr (internal::is_simd_searchable<RandomIt>())
+        return first + internal::count_less(&*first, n, T(key));
+
+    while (n > 1) {
+        auto half = n / 2;
+        first = first[half] < key ? first + half : first;
+        n -= half;
+    }
+    return first + (*first < key);
+}
+
 /**
  * A space-efficient index that enables fast search operations on a sorted sequence of @c n numbers.
  *
@@ -59,71 +652,358 @@ struct ApproxPos {
  * @tparam K the type of the indexed keys
  * @tparam Epsilon controls the size of the returned search range
  * @tparam EpsilonRecursive controls the size of the search range in the internal structure
- * @tparam Floating the floating-point type to use for slopes
+ * @tparam Floating the floating-point type to use for slopes, or @ref FixedPoint
+ * @tparam Intercept the signed integer type to use for intercepts, which must be able to represent @c n
+ * @tparam Segmentation the segmentation policy used at construction time, either @ref OptimalSegmentation or the
+ * faster @ref ShrinkingConeSegmentation, which produces more segments
+ * @tparam Instrumentation the policy that counts the events of the searches, either @ref NoInstrumentation, which
+ * compiles out, or @ref CountingInstrumentation
  */
-template<typename K, size_t Epsilon = 64, size_t EpsilonRecursive = 4, typename Floating = float>
+template<typename K, size_t Epsilon = 64, size_t EpsilonRecursive = 4, typename Floating = float,
+         typename Intercept = int32_t, typename Segmentation = OptimalSegmentation,
+         typename Instrumentation = NoInstrumentation>
 class PGMIndex {
 protected:
-    template<typename, size_t, size_t, uint8_t, typename>
+    template<typename, size_t, size_t, uint8_t, typename, typename>
     friend class BucketingPGMIndex;
 
-    template<typename, size_t, typename>
+    template<typename, size_t, typename, typename>
     friend class EliasFanoPGMIndex;
 
+    template<typename, size_t, size_t, typename, typename, typename>
+    friend class SoAPGMIndex;
+
+    template<typename, size_t, size_t, typename, typename, typename>
+    friend class CacheAlignedPGMIndex;
+
+    template<typename, size_t, size_t, typename, typename, typename>
+    friend class AppendablePGMIndex;
+
+    template<typename, typename, typename, typename>
+    friend class DynamicEpsilonPGMIndex;
+
+    template<typename, size_t, typename, typename, typename>
+    friend class WorkloadAwarePGMIndex;
+
     static_assert(Epsilon > 0);
+    static_assert(std::is_signed_v<Intercept>);
     struct Segment;
 
-    size_t n;                           ///< The number of elements this index was built on.
-    K first_key;                        ///< The smallest element.
-    std::vector<Segment> segments;      ///< The segments composing the index.
-    std::vector<size_t> levels_offsets; ///< The starting position of each level in segments[], in reverse order.
+    using error_type = std::conditional_t<(Epsilon + 2 <= INT8_MAX), int8_t,
+                                          std::conditional_t<(Epsilon + 2 <= INT16_MAX), int16_t, int32_t>>;
+
+    /**
+     * The search range of a segment of the last level, as offsets from the position it predicts. It is measured on
+     * the keys at construction time, so it is often narrower than the one given by Epsilon, and never wider.
+     */
+    struct ErrorBounds {
+        error_type lo; ///< The offset of the first position of the range, not less than -Epsilon.
+        error_type hi; ///< The offset of one past the last position of the range, not greater than Epsilon + 2.
+    };
+
+    /** The header of the files written by @ref save. The arrays of the index follow it, aligned to a cache line. */
+    struct FileHeader {
+        static constexpr char expected_magic[8] = {'P', 'G', 'M', 'I', 'N', 'D', 'E', 'X'};
+        static constexpr uint32_t current_version = 2;
+        static constexpr size_t alignment = 64;
+
+        char magic[8];               ///< The string PGMINDEX.
+        uint32_t version;            ///< The version of the file format, also used to detect a different endianness.
+        uint8_t key_size;            ///< The value of sizeof(K).
+        uint8_t key_kind;            ///< 0 if K is unsigned, 1 if K is signed, 2 if K is floating point.
+        uint8_t slope_size;          ///< The value of sizeof(Floating).
+        uint8_t intercept_size;      ///< The value of sizeof(Intercept).
+        uint64_t segment_size;       ///< The value of sizeof(Segment).
+        uint64_t epsilon;            ///< The value of Epsilon.
+        uint64_t epsilon_recursive;  ///< The value of EpsilonRecursive.
+        uint64_t n;                  ///< The number of elements the index was built on.
+        uint64_t levels_count;       ///< The number of entries of levels_offsets.
+        uint64_t levels_offset;      ///< The position in the file of levels_offsets.
+        uint64_t segments_count;     ///< The number of segments.
+        uint64_t segments_offset;    ///< The position in the file of the segments.
+        uint64_t errors_count;       ///< The number of error bounds, 0 if they were not computed.
+        uint64_t errors_offset;      ///< The position in the file of the error bounds.
+        K first_key;                 ///< The smallest element.
 
+        FileHeader() = default;
+
+        explicit FileHeader(const PGMIndex &pgm) {
+            // Zero the padding too, so that equal indexes are written to equal files
+            std::memset(this, 0, sizeof(FileHeader));
+            std::copy_n(expected_magic, sizeof(magic), magic);
+            version = current_version;
+            key_size = sizeof(K);
+            key_kind = std::is_floating_point_v<K> ? 2 : std::is_signed_v<K>;
+            slope_size = sizeof(Floating);
+            intercept_size = sizeof(Intercept);
+            segment_size = sizeof(Segment);
+            epsilon = Epsilon;
+            epsilon_recursive = EpsilonRecursive;
+            n = pgm.n;
+            levels_count = pgm.levels_offsets.size();
+            levels_offset = align(sizeof(FileHeader));
+            segments_count = pgm.segments.size();
+            segments_offset = align(levels_offset + levels_count * sizeof(size_t));
+            errors_count = pgm.errors.size();
+            errors_offset = align(segments_offset + segments_count * sizeof(Segment));
+            first_key = pgm.first_key;
+        }
+
+        static uint64_t align(uint64_t offset) { return (offset + alignment - 1) / alignment * alignment; }
+
+        /**
+         * Throws an exception if this header was not written by an index of the same type, if its counts are
+         * inconsistent, or if the file is too short for the arrays it describes.
+         */
+        void validate(size_t file_bytes) const {
+            if (!std::equal(magic, magic + sizeof(magic), expected_magic))
+                throw std::runtime_error("Not a PGM-index file");
+            if (version != current_version)
+                throw std::runtime_error("Unsupported PGM-index file version " + std::to_string(version));
+            if (key_size != sizeof(K) || key_kind != (std::is_floating_point_v<K> ? 2 : std::is_signed_v<K>)
+                || slope_size != sizeof(Floating) || intercept_size != sizeof(Intercept)
+                || segment_size != sizeof(Segment))
+                throw std::runtime_error("The PGM-index file was written with different key or segment types");
+            if (epsilon != Epsilon || epsilon_recursive != EpsilonRecursive)
+                throw std::runtime_error("The PGM-index file was written with different Epsilon values");
+            if (levels_count == 0 ? n != 0 || segments_count != 0 || errors_count != 0 : levels_count < 2)
+                throw std::runtime_error("The PGM-index file has an invalid number of levels");
+            auto fits = [&](uint64_t offset, uint64_t count, uint64_t size) {
+                return offset <= file_bytes && count <= (file_bytes - offset) / size;
+            };
+            if (!fits(levels_offset, levels_count, sizeof(size_t))
+                || !fits(segments_offset, segments_count, sizeof(Segment))
+                || !fits(errors_offset, errors_count, sizeof(ErrorBounds)))
+                throw std::runtime_error("The PGM-index file is truncated");
+        }
+
+        /** Throws an exception if @p offsets are not the offsets of the levels of the segments in this header. */
+        void validate_levels(const std::vector<size_t> &offsets) const {
+            if (offsets.empty())
+                return;
+            // Each level has at least a segment and a sentinel, and the last level has one per error bound if any
+            auto increasing = std::adjacent_find(offsets.begin(), offsets.end(), [](size_t a, size_t b) {
+                return b < a + 2;
+            }) == offsets.end();
+            if (offsets.front() != 0 || !increasing || offsets.back() != segments_count
+                || (errors_count != 0 && errors_count != offsets[1] - 1))
+                throw std::runtime_error("The PGM-index file has invalid level offsets");
+        }
+    };
+
+    size_t n;                                  ///< The number of elements this index was built on.
+    K first_key;                               ///< The smallest element.
+    internal::MappableArray<Segment> segments; ///< The segments composing the index.
+    std::vector<size_t> levels_offsets;        ///< The starting position of each level in segments[], in reverse order.
+    internal::MappableArray<ErrorBounds> errors; ///< The search ranges of the last level, or empty if not measured.
+
+    template<typename It>
+    PGMIndex(It first, It last, SegmentationWorkspace<K> *workspace)
+        : n(0),
+          first_key(),
+          segments(),
+          levels_offsets(),
+          errors() {
+        std::vector<Segment> tmp;
+        n = build(first, last, Epsilon, EpsilonRecursive, tmp, levels_offsets, workspace);
+        first_key = n ? tmp.front().key : K(0);
+        using category = typename std::iterator_traits<It>::iterator_category;
+        if constexpr (std::is_base_of_v<std::random_access_iterator_tag, category>)
+            if (n)
+                errors = error_bounds(first, n, tmp, levels_offsets[1] - 1);
+        segments = std::move(tmp);
+    }
+
+    /**
+     * Measures the search range of each segment of the last level on the keys.
+     *
+     * The keys that a segment is responsible for are split into pieces with the same answer (the position of the first
+     * key not less than them), namely each indexed key and the keys between two consecutive indexed ones. Since the
+     * predicted position does not decrease with the key, the difference between the answer and the prediction on a
+     * piece is bounded by the predictions at its ends.
+     *
+     * @param first the beginning of the sorted keys
+     * @param n the number of keys
+     * @param segments the segments of the index
+     * @param count the number of segments in the last level
+     * @return the search range of each segment of the last level
+     */
     template<typename RandomIt>
-    static void build(RandomIt first, RandomIt last,
-                      size_t epsilon, size_t epsilon_recursive,
-                      std::vector<Segment> &segments,
-                      std::vector<size_t> &levels_offsets) {
-        auto n = (size_t) std::distance(first, last);
-        if (n == 0)
-            return;
+    static std::vector<ErrorBounds> error_bounds(RandomIt first, size_t n, const std::vector<Segment> &segments,
+                                                 size_t count) {
+        std::vector<ErrorBounds> result(count);
+        size_t p = 0;
+        for (size_t s = 0; s < count; ++s) {
+            auto &segment = segments[s];
+            auto has_end = s + 1 < count;
+            auto end = segments[s + 1].key;
+            auto max_pos = size_t(segments[s + 1].intercept);
+            auto predict = [&](const K &k) { return std::min<size_t>(segment(k), max_pos); };
+            auto lo = std::numeric_limits<int64_t>::max();
+            auto hi = std::numeric_limits<int64_t>::min();
 
-        levels_offsets.push_back(0);
-        segments.reserve(n / (epsilon * epsilon));
+            // Adds the piece [left, right) whose answer is the given position, with right = end if !has_right
+            auto add_piece = [&](size_t answer, const K &left, bool has_right, const K &right) {
+                auto right_pos = has_right ? predict(right) : max_pos;
+                hi = std::max(hi, int64_t(answer) - int64_t(predict(left)));
+                lo = std::min(lo, int64_t(answer) - int64_t(right_pos));
+            };
 
-        auto ignore_last = *std::prev(last) == std::numeric_limits<K>::max(); // max() is the sentinel value
-        auto last_n = n - ignore_last;
-        last -= ignore_last;
+            while (p < n && K(first[p]) < segment.key)
+                ++p;
+            if (p == n || segment.key < K(first[p])) {
+                auto has_right = p < n || has_end;
+                add_piece(p, segment.key, has_right, p < n && (!has_end || K(first[p]) < end) ? K(first[p]) : end);
+            }
+
+            while (p < n && (!has_end || K(first[p]) < end)) {
+                K x = first[p];
+                auto q = p + 1;
+                while (q < n && K(first[q]) == x)
+                    ++q;
+
+                auto x_pos = int64_t(predict(x));
+                lo = std::min(lo, int64_t(p) - x_pos);
+                hi = std::max(hi, int64_t(p) - x_pos);
+
+                // The keys strictly between x and the next indexed key, or the end of the segment
+                auto has_right = q < n || has_end;
+                auto right = q < n && (!has_end || K(first[q]) < end) ? K(first[q]) : end;
+                if constexpr (std::is_integral_v<K>) {
+                    if (x != std::numeric_limits<K>::max() && (!has_right || K(x + 1) < right))
+                        add_piece(q, K(x + 1), has_right, right);
+                } else {
+                    add_piece(q, x, has_right, right);
+                }
+                p = q;
+            }
 
-        auto build_level = [&](auto epsilon, auto in_fun, auto out_fun) {
-            auto n_segments = internal::make_segmentation_par(last_n, epsilon, in_fun, out_fun);
-            if (segments.back().slope == 0 && last_n > 1) {
-                // Here we need to ensure that keys > *(last-1) are approximated to a position == prev_level_size
-                segments.emplace_back(*std::prev(last) + 1, 0, last_n);
+            if (lo > hi) {
+                result[s] = {error_type(-int64_t(Epsilon)), error_type(Epsilon + 2)};
+                continue;
+            }
+            result[s].lo = error_type(std::max<int64_t>(lo, -int64_t(Epsilon)));
+            result[s].hi = error_type(std::min<int64_t>(hi + 1, Epsilon + 2));
+        }
+        return result;
+    }
+
+    /**
+     * Builds the levels of the index on the sorted keys in [first, last).
+     *
+     * Random-access ranges are segmented in parallel. Other ranges are read in a single pass, keeping in memory only
+     * the segments and a window of three keys, so that the keys can be streamed from a file or another source larger
+     * than the memory.
+     *
+     * @param workspace the memory to reuse for the segmentation, or nullptr to allocate it
+     * @return the number of keys in [first, last)
+     */
+    template<typename It>
+    static size_t build(It first, It last,
+                        size_t epsilon, size_t epsilon_recursive,
+                        std::vector<Segment> &segments,
+                        std::vector<size_t> &levels_offsets,
+                        SegmentationWorkspace<K> *workspace = nullptr) {
+        if (first == last)
+            return 0;
+
+        SegmentationWorkspace<K> local;
+        auto &ws = workspace ? *workspace : local;
+
+        size_t n;
+        size_t last_n;
+        K last_key{};
+        levels_offsets.push_back(0);
+
+        auto finish_level = [&](size_t n_segments) {
+            if (last_n > 1 && segments.back().slope == 0) {
+                // Here we need to ensure that keys > last_key are approximated to a position == prev_level_size
+                segments.emplace_back(last_key + 1, 0, last_n);
                 ++n_segments;
             }
             segments.emplace_back(last_n); // Add the sentinel segment
+            levels_offsets.push_back(levels_offsets.back() + n_segments + 1);
             return n_segments;
         };
 
         // Build first level
-        auto in_fun = [&](auto i) {
-            auto x = first[i];
-            // Here there is an adjustment for inputs with duplicate keys: at the end of a run of duplicate keys equal
-            // to x=first[i] such that x+1!=first[i+1], we map the values x+1,...,first[i+1]-1 to their correct rank i
-            auto flag = i > 0 && i + 1u < n && x == first[i - 1] && x != first[i + 1] && x + 1 != first[i + 1];
-            return std::pair<K, size_t>(x + flag, i);
-        };
-        auto out_fun = [&](auto cs) { segments.emplace_back(cs); };
-        last_n = build_level(epsilon, in_fun, out_fun);
-        levels_offsets.push_back(levels_offsets.back() + last_n + 1);
+        using category = typename std::iterator_traits<It>::iterator_category;
+        if constexpr (std::is_base_of_v<std::random_access_iterator_tag, category>) {
+            n = (size_t) std::distance(first, last);
+            segments.reserve(n / (epsilon * epsilon));
+
+            auto ignore_last = *std::prev(last) == std::numeric_limits<K>::max(); // max() is the sentinel value
+            last_n = n - ignore_last;
+            last -= ignore_last;
+            if (last_n > 0)
+                last_key = *std::prev(last);
+
+            auto in_fun = [&](auto i) {
+                auto x = first[i];
+                // Here there is an adjustment for inputs with duplicate keys: at the end of a run of duplicate keys
+                // equal to x=first[i] such that x+1!=first[i+1], we map the values x+1,...,first[i+1]-1 to their
+                // correct rank i
+                auto flag = i > 0 && i + 1u < n && x == first[i - 1] && x != first[i + 1] && x + 1 != first[i + 1];
+                return std::pair<K, size_t>(x + flag, i);
+            };
+            auto n_segments = internal::make_segmentation_par_into<Segment, Segmentation>(last_n, epsilon, in_fun,
+                                                                                          segments, 0, &ws);
+            last_n = finish_level(n_segments);
+        } else {
+            // The same points as above are computed from a window (prev, x, next) that slides over the input
+            typename Segmentation::template model<K, size_t> opt(epsilon, ws.hull(0));
+            size_t n_segments = 0;
+            size_t points = 0;
+            K prev = *first;
+            K x = prev;
+            K last_x = x;
+            for (n = 0;; ++n) {
+                auto has_next = ++first != last;
+                auto next = has_next ? K(*first) : x;
+                auto ignore = !has_next && x == std::numeric_limits<K>::max(); // max() is the sentinel value
+                if (!ignore) {
+                    auto flag = n > 0 && has_next && x == prev && x != next && x + 1 != next;
+                    auto px = K(x + flag);
+                    if (points == 0) {
+                        opt.add_point(px, n);
+                        ++points;
+                    } else if (px != last_x) {
+                        if (!opt.add_point(px, n)) {
+                            segments.emplace_back(opt.get_segment());
+                            opt.add_point(px, n);
+                            ++n_segments;
+                        }
+                        ++points;
+                    }
+                    last_x = px;
+                    last_key = x;
+                }
+                if (!has_next)
+                    break;
+                prev = x;
+                x = next;
+            }
+            ++n;
+
+            last_n = n - (x == std::numeric_limits<K>::max());
+            if (points > 0) {
+                segments.emplace_back(opt.get_segment());
+                ++n_segments;
+            }
+            opt.release(ws.hull(0));
+            last_n = finish_level(n_segments);
+        }
 
         // Build upper levels
         while (epsilon_recursive && last_n > 1) {
             auto offset = levels_offsets[levels_offsets.size() - 2];
             auto in_fun_rec = [&](auto i) { return std::pair<K, size_t>(segments[offset + i].key, i); };
-            last_n = build_level(epsilon_recursive, in_fun_rec, out_fun);
-            levels_offsets.push_back(levels_offsets.back() + last_n + 1);
+            auto n_segments = internal::make_segmentation_par_into<Segment, Segmentation>(last_n, epsilon_recursive,
+                                                                                          in_fun_rec, segments, 0, &ws);
+            last_n = finish_level(n_segments);
         }
+
+        return n;
     }
 
     /**
@@ -133,32 +1013,49 @@ protected:
      */
     auto segment_for_key(const K &key) const {
         if constexpr (EpsilonRecursive == 0) {
+            internal::record<Instrumentation>([&](auto &c) {
+                ++c.levels;
+                c.segments_scanned += internal::binary_search_probes(segments_count());
+            });
             return std::prev(std::upper_bound(segments.begin(), segments.begin() + segments_count(), key));
         }
 
-        auto it = segments.begin() + *(levels_offsets.end() - 2);
-        for (auto l = int(height()) - 2; l >= 0; --l) {
-            auto level_begin = segments.begin() + levels_offsets[l];
-            auto pos = std::min<size_t>((*it)(key), std::next(it)->intercept);
-            auto lo = level_begin + PGM_SUB_EPS(pos, EpsilonRecursive + 1);
-
-            static constexpr size_t linear_search_threshold = 8 * 64 / sizeof(Segment);
-            if constexpr (EpsilonRecursive <= linear_search_threshold) {
-                for (; std::next(lo)->key <= key; ++lo)
-                    continue;
-                it = lo;
-            } else {
-                auto level_size = levels_offsets[l + 1] - levels_offsets[l] - 1;
-                auto hi = level_begin + PGM_ADD_EPS(pos, EpsilonRecursive, level_size);
-                it = std::prev(std::upper_bound(lo, hi, key));
-            }
+        return internal::segment_in_levels<EpsilonRecursive, Instrumentation>(segments.begin(), levels_offsets,
+                                                                              EpsilonRecursive, key);
+    }
+
+    /**
+     * Returns the approximate position and the range computed by the given segment for @p key.
+     * @param it the segment responsible for @p key
+     * @param key the value of the element to search for, must be not less than @ref first_key
+     * @return a struct with the approximate position and bounds of the range
+     */
+    template<typename SegmentIt>
+    ApproxPos approx_pos(SegmentIt it, const K &key) const {
+        auto pos = internal::predict<Instrumentation>(it, key);
+        size_t lo;
+        size_t hi;
+        if (errors.empty()) {
+            lo = PGM_SUB_EPS(pos, Epsilon);
+            hi = PGM_ADD_EPS(pos, Epsilon, n);
+        } else {
+            auto &e = errors[std::distance(segments.begin(), it)];
+            auto e_hi = std::min<int64_t>(pos + e.hi, n);
+            lo = size_t(std::clamp<int64_t>(int64_t(pos) + e.lo, 0, e_hi));
+            hi = size_t(e_hi);
         }
-        return it;
+
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.searches;
+            c.window += hi - lo;
+        });
+        return {pos, lo, hi};
     }
 
 public:
 
     static constexpr size_t epsilon_value = Epsilon;
+    static constexpr size_t batch_group_size = 16; ///< The number of keys that @ref search_batch processes together.
 
     /**
      * Constructs an empty index.
@@ -173,15 +1070,86 @@ public:
 
     /**
      * Constructs the index on the sorted keys in the range [first, last).
+     *
+     * If the iterators are not random-access, e.g. they are the iterators of a @ref BinaryFileReader, the keys are
+     * read in a single pass and only the segments are kept in memory.
+     *
      * @param first, last the range containing the sorted keys to be indexed
      */
-    template<typename RandomIt>
-    PGMIndex(RandomIt first, RandomIt last)
-        : n(std::distance(first, last)),
-          first_key(n ? *first : K(0)),
-          segments(),
-          levels_offsets() {
-        build(first, last, Epsilon, EpsilonRecursive, segments, levels_offsets);
+    template<typename It>
+    PGMIndex(It first, It last) : PGMIndex(first, last, nullptr) {}
+
+    /**
+     * Constructs the index on the sorted keys in the range [first, last), reusing the memory of @p workspace for the
+     * segmentation. After the first constructions, successive ones that share a workspace do not allocate it again.
+     *
+     * @param first, last the range containing the sorted keys to be indexed
+     * @param workspace the memory to reuse for the segmentation
+     */
+    template<typename It>
+    PGMIndex(It first, It last, SegmentationWorkspace<K> &workspace) : PGMIndex(first, last, &workspace) {}
+
+    /**
+     * Writes the index to the given file, which can be loaded back with @ref open_mapped.
+     *
+     * The file starts with a versioned header, followed by the arrays of the index aligned to a cache line and in
+     * the same layout as in memory, so they are used in place once the file is mapped.
+     *
+     * @param path the path of the file to write
+     */
+    void save(const std::string &path) const {
+        FileHeader header(*this);
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        auto pad_to = [&](uint64_t offset) {
+            while (uint64_t(out.tellp()) < offset)
+                out.put(0);
+        };
+
+        out.write((const char *) &header, sizeof(header));
+        pad_to(header.levels_offset);
+        out.write((const char *) levels_offsets.data(), levels_offsets.size() * sizeof(size_t));
+        pad_to(header.segments_offset);
+        out.write((const char *) segments.data(), segments.size() * sizeof(Segment));
+        pad_to(header.errors_offset);
+        out.write((const char *) errors.data(), errors.size() * sizeof(ErrorBounds));
+        if (!out.flush())
+            throw std::runtime_error("Error writing the PGM-index file " + path);
+    }
+
+    /**
+     * Loads an index from a file written by @ref save, by mapping it in memory.
+     *
+     * The segments are not copied nor parsed, so the cost of loading does not depend on the size of the index. The
+     * file stays mapped as long as the returned index, or any of its copies, is alive.
+     *
+     * @param path the path of the file to load
+     * @return the index stored in the file
+     */
+    static PGMIndex open_mapped(const std::string &path) {
+        struct stat fs;
+        if (stat(path.c_str(), &fs) != 0)
+            throw std::runtime_error("Open file error " + std::string(strerror(errno)));
+        auto file_bytes = size_t(fs.st_size);
+        if (file_bytes < sizeof(FileHeader))
+            throw std::runtime_error("The PGM-index file is truncated");
+
+        auto file = internal::map_file(path, file_bytes);
+        auto base = static_cast<const char *>(file.get());
+        FileHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        header.validate(file_bytes);
+
+        PGMIndex pgm;
+        pgm.n = header.n;
+        pgm.first_key = header.first_key;
+        pgm.levels_offsets.resize(header.levels_count);
+        std::memcpy(pgm.levels_offsets.data(), base + header.levels_offset, header.levels_count * sizeof(size_t));
+        header.validate_levels(pgm.levels_offsets);
+        auto first_segment = reinterpret_cast<const Segment *>(base + header.segments_offset);
+        auto first_error = reinterpret_cast<const ErrorBounds *>(base + header.errors_offset);
+        pgm.errors = internal::MappableArray<ErrorBounds>(first_error, header.errors_count, file);
+        pgm.segments = internal::MappableArray<Segment>(first_segment, header.segments_count, std::move(file));
+        return pgm;
     }
 
     /**
@@ -191,11 +1159,96 @@ public:
      */
     ApproxPos search(const K &key) const {
         auto k = std::max(first_key, key);
-        auto it = segment_for_key(k);
-        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
-        auto lo = PGM_SUB_EPS(pos, Epsilon);
-        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
-        return {pos, lo, hi};
+        return approx_pos(segment_for_key(k), k);
+    }
+
+    /**
+     * Returns the approximate positions and the ranges where the keys in [first, last) can be found.
+     *
+     * The keys are processed in groups of @ref batch_group_size that descend the levels of the index in lockstep. At
+     * each level, the segments of the whole group are prefetched before any of them is searched, so that the cache
+     * misses of different keys overlap rather than being paid one after the other.
+     *
+     * @param first, last the range containing the values of the elements to search for
+     * @param out the beginning of the destination range, which receives one @ref ApproxPos per key
+     * @return an iterator to the element past the last one written
+     */
+    template<typename InputIt, typename OutputIt>
+    OutputIt search_batch(InputIt first, InputIt last, OutputIt out) const {
+        using segment_iterator = decltype(segments.cbegin());
+        K keys[batch_group_size];
+        segment_iterator its[batch_group_size];
+
+        while (first != last) {
+            size_t g = 0;
+            for (; g < batch_group_size && first != last; ++g, ++first)
+                keys[g] = std::max(first_key, K(*first));
+
+            if constexpr (EpsilonRecursive == 0) {
+                for (size_t i = 0; i < g; ++i)
+                    its[i] = segment_for_key(keys[i]);
+            } else {
+                auto root = segments.begin() + *(levels_offsets.end() - 2);
+                size_t pos[batch_group_size];
+                for (size_t i = 0; i < g; ++i)
+                    its[i] = root;
+
+                for (auto l = int(height()) - 2; l >= 0; --l) {
+                    auto level_begin = segments.begin() + levels_offsets[l];
+                    auto level_size = levels_offsets[l + 1] - levels_offsets[l] - 1;
+                    for (size_t i = 0; i < g; ++i) {
+                        pos[i] = internal::predict<Instrumentation>(its[i], keys[i]);
+                        __builtin_prefetch(&*(level_begin + PGM_SUB_EPS(pos[i], EpsilonRecursive + 1)), 0, 0);
+                        __builtin_prefetch(&*(level_begin + pos[i]), 0, 0);
+                    }
+                    for (size_t i = 0; i < g; ++i)
+                        its[i] = internal::segment_in_level<EpsilonRecursive, Instrumentation>(
+                            level_begin, level_size, pos[i], EpsilonRecursive, keys[i]);
+                }
+            }
+
+            for (size_t i = 0; i < g; ++i)
+                *out++ = approx_pos(its[i], keys[i]);
+        }
+
+        return out;
+    }
+
+    /**
+     * Returns the approximate positions and the ranges where the given keys can be found.
+     * @param keys the values of the elements to search for
+     * @param out the vector that receives one @ref ApproxPos per key, in the same order as @p keys
+     */
+    void search_batch(const std::vector<K> &keys, std::vector<ApproxPos> &out) const {
+        out.resize(keys.size());
+        search_batch(keys.begin(), keys.end(), out.begin());
+    }
+
+    class Cursor;
+
+    /**
+     * Returns a cursor for searching keys in ascending order.
+     * @return a cursor positioned before the first segment
+     */
+    Cursor cursor() const { return Cursor(*this); }
+
+    /**
+     * Returns the approximate positions and the ranges where the keys in [first, last) can be found.
+     *
+     * The keys should be sorted in ascending order. They are searched with a @ref Cursor, so that the cost per key
+     * is amortized O(1) when the keys are dense with respect to the segments. Unsorted keys give correct results too,
+     * but the search may be slower than calling @ref search for each key.
+     *
+     * @param first, last the range containing the values of the elements to search for
+     * @param out the beginning of the destination range, which receives one @ref ApproxPos per key
+     * @return an iterator to the element past the last one written
+     */
+    template<typename InputIt, typename OutputIt>
+    OutputIt search_sorted(InputIt first, InputIt last, OutputIt out) const {
+        auto c = cursor();
+        for (; first != last; ++first)
+            *out++ = c.search(*first);
+        return out;
     }
 
     /**
@@ -214,28 +1267,95 @@ public:
      * Returns the size of the index in bytes.
      * @return the size of the index in bytes
      */
-    size_t size_in_bytes() const { return segments.size() * sizeof(Segment) + levels_offsets.size() * sizeof(size_t); }
+    size_t size_in_bytes() const {
+        return segments.size() * sizeof(Segment) + levels_offsets.size() * sizeof(size_t)
+            + errors.size() * sizeof(ErrorBounds);
+    }
+};
+
+/**
+ * A cursor that searches a @ref PGMIndex for keys given in ascending order.
+ *
+ * The cursor remembers the segment of the last key it searched. The next key is searched by galloping forward from
+ * that segment along the last level of the index, so a key that falls in the same or in a nearby segment costs a
+ * few comparisons instead of a descent from the root. The cursor descends from the root only when the key is smaller
+ * than the previous one or the gallop exceeds @ref max_gallop segments. The instrumentation policy of the index counts
+ * a gallop that finds the segment as a search of one level, and the segments it compared as scanned.
+ */
+template<typename K, size_t Epsilon, size_t EpsilonRecursive, typename Floating, typename Intercept,
+         typename Segmentation, typename Instrumentation>
+class PGMIndex<K, Epsilon, EpsilonRecursive, Floating, Intercept, Segmentation, Instrumentation>::Cursor {
+    using segment_iterator = decltype(std::declval<const PGMIndex &>().segments.cbegin());
+
+    const PGMIndex *pgm;  ///< The index being searched.
+    segment_iterator it;  ///< The segment responsible for the last key searched, or nullptr.
+
+public:
+
+    static constexpr size_t max_gallop = 64; ///< The longest jump, in segments, before descending from the root.
+
+    explicit Cursor(const PGMIndex &pgm) : pgm(&pgm), it() {}
+
+    /**
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for, preferably not less than the one of the previous call
+     * @return a struct with the approximate position and bounds of the range
+     */
+    ApproxPos search(const K &key) {
+        auto k = std::max(pgm->first_key, key);
+        if (it == segment_iterator() || k < it->key) {
+            it = pgm->segment_for_key(k);
+            return pgm->approx_pos(it, k);
+        }
+
+        // Gallop forward to find a range [it + step / 2, it + step) of the last level containing the segment for k
+        auto last = pgm->segments.cbegin() + pgm->segments_count();
+        size_t step = 1;
+        size_t scanned = 0;
+        for (; step <= max_gallop && it + step < last; step *= 2) {
+            ++scanned;
+            if (k < (it + step)->key)
+                break;
+        }
+
+        if (step > max_gallop) {
+            internal::record<Instrumentation>([&](auto &c) { c.segments_scanned += scanned; });
+            it = pgm->segment_for_key(k);
+        } else {
+            auto hi = std::min(it + step, last);
+            if (step > 1)
+                scanned += internal::binary_search_probes(std::distance(it + step / 2, hi));
+            internal::record<Instrumentation>([&](auto &c) {
+                ++c.levels;
+                c.segments_scanned += scanned;
+            });
+            if (step > 1)
+                it = std::prev(std::upper_bound(it + step / 2, hi, k));
+        }
+        return pgm->approx_pos(it, k);
+    }
 };
 
 #pragma pack(push, 1)
 
-template<typename K, size_t Epsilon, size_t EpsilonRecursive, typename Floating>
-struct PGMIndex<K, Epsilon, EpsilonRecursive, Floating>::Segment {
-    K key;             ///< The first key that the segment indexes.
-    Floating slope;    ///< The slope of the segment.
-    int32_t intercept; ///< The intercept of the segment.
+template<typename K, size_t Epsilon, size_t EpsilonRecursive, typename Floating, typename Intercept,
+         typename Segmentation, typename Instrumentation>
+struct PGMIndex<K, Epsilon, EpsilonRecursive, Floating, Intercept, Segmentation, Instrumentation>::Segment {
+    K key;               ///< The first key that the segment indexes.
+    Floating slope;      ///< The slope of the segment.
+    Intercept intercept; ///< The intercept of the segment.
 
     Segment() = default;
 
-    Segment(K key, Floating slope, int32_t intercept) : key(key), slope(slope), intercept(intercept) {};
+    Segment(K key, Floating slope, Intercept intercept) : key(key), slope(slope), intercept(intercept) {};
 
     explicit Segment(size_t n) : key(std::numeric_limits<K>::max()), slope(), intercept(n) {};
 
     explicit Segment(const typename internal::OptimalPiecewiseLinearModel<K, size_t>::CanonicalSegment &cs)
         : key(cs.get_first_x()) {
         auto[cs_slope, cs_intercept] = cs.get_floating_point_segment(key);
-        if (cs_intercept > std::numeric_limits<decltype(intercept)>::max())
-            throw std::overflow_error("Change the type of Segment::intercept to int64");
+        if (cs_intercept > std::numeric_limits<Intercept>::max())
+            throw std::overflow_error("The intercept does not fit the Intercept type, use a wider one such as int64_t");
         slope = cs_slope;
         intercept = cs_intercept;
     }
@@ -259,4 +1379,182 @@ struct PGMIndex<K, Epsilon, EpsilonRecursive, Floating>::Segment {
 
 #pragma pack(pop)
 
+/**
+ * A @ref PGMIndex whose epsilon and recursive epsilon are chosen at runtime.
+ *
+ * This is useful when the space-time trade-off is decided when the data is loaded, e.g. per table or by a tuner.
+ * The index has the same layout as a @ref PGMIndex built with the same parameters. Its searches dispatch to search
+ * kernels specialized at compile time for the power-of-two values of epsilon up to 4096, and fall back to generic
+ * kernels for the other values.
+ *
+ * @tparam K the type of the indexed keys
+ * @tparam Floating the floating-point type to use for slopes, or @ref FixedPoint
+ * @tparam Intercept the signed integer type to use for intercepts, which must be able to represent @c n
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex
+ */
+template<typename K, typename Floating = float, typename Intercept = int32_t,
+         typename Instrumentation = NoInstrumentation>
+class DynamicEpsilonPGMIndex {
+protected:
+    using Segment = typename PGMIndex<K, 1, 1, Floating, Intercept>::Segment;
+    using segment_kernel = size_t (*)(const DynamicEpsilonPGMIndex &, const K &);
+
+    size_t n{};                                            ///< The number of elements this index was built on.
+    K first_key{};                                         ///< The smallest element.
+    size_t epsilon{};                                      ///< The epsilon of the last level.
+    size_t epsilon_recursive{};                            ///< The epsilon of the internal levels.
+    std::vector<Segment> segments;                         ///< The segments composing the index.
+    std::vector<size_t> levels_offsets;                    ///< The start of each level in segments[], in reverse order.
+    segment_kernel segment_for_key{&flat_segment_for_key}; ///< The kernel that finds the segment of a key.
+
+    /**
+     * Returns the position of the rightmost segment having key <= the sought key in the last level, when the index
+     * has a single level.
+     */
+    static size_t flat_segment_for_key(const DynamicEpsilonPGMIndex &pgm, const K &key) {
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.levels;
+            c.segments_scanned += internal::binary_search_probes(pgm.segments_count());
+        });
+        auto first = pgm.segments.begin();
+        return std::distance(first, std::upper_bound(first, first + pgm.segments_count(), key)) - 1;
+    }
+
+    /**
+     * Returns the position of the rightmost segment having key <= the sought key in the last level.
+     * @tparam EpsilonRecursive the recursive epsilon of the index, or 0 if it must be read at runtime
+     */
+    template<size_t EpsilonRecursive>
+    static size_t recursive_segment_for_key(const DynamicEpsilonPGMIndex &pgm, const K &key) {
+        auto epsilon_recursive = EpsilonRecursive ? EpsilonRecursive : pgm.epsilon_recursive;
+        auto first = pgm.segments.begin();
+        auto it = internal::segment_in_levels<EpsilonRecursive, Instrumentation>(first, pgm.levels_offsets,
+                                                                                 epsilon_recursive, key);
+        return std::distance(first, it);
+    }
+
+public:
+
+    /**
+     * Constructs an empty index.
+     */
+    DynamicEpsilonPGMIndex() = default;
+
+    /**
+     * Constructs the index on the given sorted vector.
+     * @param data the vector of keys to be indexed, must be sorted
+     * @param epsilon controls the size of the returned search range, must be > 0
+     * @param epsilon_recursive controls the size of the search range in the internal structure
+     */
+    DynamicEpsilonPGMIndex(const std::vector<K> &data, size_t epsilon, size_t epsilon_recursive = 4)
+        : DynamicEpsilonPGMIndex(data.begin(), data.end(), epsilon, epsilon_recursive) {}
+
+    /**
+     * Constructs the index on the sorted keys in the range [first, last).
+     * @param first, last the range containing the sorted keys to be indexed
+     * @param epsilon controls the size of the returned search range, must be > 0
+     * @param epsilon_recursive controls the size of the search range in the internal structure
+     */
+    template<typename RandomIt>
+    DynamicEpsilonPGMIndex(RandomIt first, RandomIt last, size_t epsilon, size_t epsilon_recursive = 4)
+        : n(std::distance(first, last)),
+          first_key(n ? *first : K(0)),
+          epsilon(epsilon),
+          epsilon_recursive(epsilon_recursive),
+          segments(),
+          levels_offsets(),
+          segment_for_key(&flat_segment_for_key) {
+        if (epsilon == 0)
+            throw std::invalid_argument("epsilon must be > 0");
+
+        using Base = PGMIndex<K, 1, 1, Floating, Intercept>;
+        Base::build(first, last, epsilon, epsilon_recursive, segments, levels_offsets);
+        if (epsilon_recursive != 0) {
+            segment_for_key = internal::dispatch_epsilon(epsilon_recursive, [](auto e) -> segment_kernel {
+                return &recursive_segment_for_key<decltype(e)::value>;
+            });
+        }
+    }
+
+    /**
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for
+     * @return a struct with the approximate position and bounds of the range
+     */
+    ApproxPos search(const K &key) const {
+        if (n == 0)
+            return {0, 0, 0};
+        auto k = std::max(first_key, key);
+        auto it = segments.begin() + segment_for_key(*this, k);
+        auto pos = internal::predict<Instrumentation>(it, k);
+        auto lo = PGM_SUB_EPS(pos, epsilon);
+        auto hi = PGM_ADD_EPS(pos, epsilon, n);
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.searches;
+            c.window += hi - lo;
+        });
+        return {pos, lo, hi};
+    }
+
+    /**
+     * Returns an iterator pointing to the first element of the indexed data that is not less than @p key.
+     *
+     * The last-mile search is done by @ref lower_bound_in specialized for the epsilon of this index, if it is a
+     * power of two not greater than 4096.
+     *
+     * @param data an iterator to the beginning of the sorted data on which the index was built
+     * @param key the value of the element to search for
+     * @return an iterator to the first element that is not less than @p key, or data + @ref size() if none is found
+     */
+    template<typename RandomIt>
+    RandomIt lower_bound_in(RandomIt data, const K &key) const {
+        auto range = search(key);
+        return internal::dispatch_epsilon(epsilon, [&](auto e) {
+            return pgm::lower_bound_in<decltype(e)::value>(data, range, key);
+        });
+    }
+
+    /**
+     * Returns the number of elements the index was built on.
+     * @return the number of elements the index was built on
+     */
+    size_t size() const { return n; }
+
+    /**
+     * Returns the epsilon of the last level.
+     * @return the epsilon of the last level
+     */
+    size_t epsilon_value() const { return epsilon; }
+
+    /**
+     * Returns the epsilon of the internal levels.
+     * @return the epsilon of the internal levels
+     */
+    size_t epsilon_recursive_value() const { return epsilon_recursive; }
+
+    /**
+     * Returns the number of segments in the last level of the index.
+     * @return the number of segments
+     */
+    size_t segments_count() const { return segments.empty() ? 0 : levels_offsets[1] - 1; }
+
+    /**
+     * Returns the number of levels of the index.
+     * @return the number of levels of the index
+     */
+    size_t height() const { return levels_offsets.size() - 1; }
+
+    /**
+     * Returns the size of the index in bytes.
+     * @return the size of the index in bytes
+     */
+    size_t size_in_bytes() const { return segments.size() * sizeof(Segment) + levels_offsets.size() * sizeof(size_t); }
+
+    /**
+     * Returns the size in bytes of a segment of the index.
+     * @return the size in bytes of a segment
+     */
+    static constexpr size_t segment_size_in_bytes() { return sizeof(Segment); }
+};
+
 }
\ No newline at end of file
@@ -19,19 +19,33 @@
 #include <cstddef>
 #include <cstdint>
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <functional>
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <new>
+#include <optional>
 #include <set>
 #include <stdexcept>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
 namespace pgm {
 
+namespace internal {
+
+template<typename T>
+class LoserTree;
+
+}
+
 /**
  * A sorted associative container that contains key-value pairs with unique keys.
  * @tparam K the type of a key
@@ -40,6 +54,9 @@ namespace pgm {
  */
 template<typename K, typename V, typename PGMType = PGMIndex<K, 16>>
 class DynamicPGMIndex {
+    template<typename, typename, typename>
+    friend class ConcurrentDynamicPGMIndex;
+
     class ItemA;
     class ItemB;
     class Iterator;
@@ -54,6 +71,7 @@ class DynamicPGMIndex {
     uint8_t used_levels;           ///< Equal to 1 + last level whose size is greater than 0, or = min_level if no data.
     std::vector<Level> levels;     ///< (i-min_level)th element is the data array at the ith level.
     std::vector<PGMType> pgms;     ///< (i-min_index_level)th element is the index at the ith level.
+    SegmentationWorkspace<K> workspace; ///< The memory reused by the constructions of the indexes.
 
     const Level &level(uint8_t level) const { return levels[level - min_level]; }
     const PGMType &pgm(uint8_t level) const { return pgms[level - min_index_level]; }
@@ -65,51 +83,70 @@ class DynamicPGMIndex {
     uint8_t ceil_log_base(size_t n) const { return (ceil_log2(n) + ceil_log2(base) - 1) / ceil_log2(base); }
     constexpr static uint8_t ceil_log2(size_t n) { return n <= 1 ? 0 : sizeof(long long) * 8 - __builtin_clzll(n - 1); }
 
-    void pairwise_merge(const Item &new_item,
-                        uint8_t target,
-                        size_t size_hint,
-                        typename Level::iterator insertion_point) {
-        Level tmp_a(size_hint + level(target).size());
-        Level tmp_b(size_hint + level(target).size());
-
-        // Insert new_item in sorted order in the first level
-        auto alternate = true;
-        auto it = std::move(level(min_level).begin(), insertion_point, tmp_a.begin());
-        *it++ = new_item;
-        it = std::move(insertion_point, level(min_level).end(), it);
-        tmp_a.resize(std::distance(tmp_a.begin(), it));
-
-        // Merge subsequent levels
-        uint8_t merge_limit = level(target).empty() ? target - 1 : target;
-        for (uint8_t i = 1 + min_level; i <= merge_limit; ++i, alternate = !alternate) {
-            auto tmp_begin = (alternate ? tmp_a : tmp_b).begin();
-            auto tmp_end = (alternate ? tmp_a : tmp_b).end();
-            auto out_begin = (alternate ? tmp_b : tmp_a).begin();
-            decltype(out_begin) out_end;
-
-            auto can_delete_permanently = i == used_levels - 1;
-            if (can_delete_permanently)
-                out_end = merge<true>(tmp_begin, tmp_end, level(i).begin(), level(i).end(), out_begin);
-            else
-                out_end = merge<false>(tmp_begin, tmp_end, level(i).begin(), level(i).end(), out_begin);
+    /**
+     * Returns the first level below the buffer that can hold @p slots_required items together with the levels above
+     * it, and adds the required items of those levels to @p slots_required. If no level can, a new one is added.
+     */
+    uint8_t merge_target(size_t &slots_required) {
+        uint8_t i;
+        for (i = min_level + 1; i < used_levels; ++i) {
+            auto slots_left_in_level = max_size(i) - level(i).size();
+            if (slots_required <= slots_left_in_level)
+                return i;
+            slots_required += level(i).size();
+        }
 
-            (alternate ? tmp_b : tmp_a).resize(std::distance(out_begin, out_end));
-            (alternate ? tmp_a : tmp_b).clear();
+        // Only a batch can be larger than the next level
+        while (max_size(i) < slots_required)
+            ++i;
+        used_levels = i + 1;
+        if (levels.size() <= size_t(i - min_level))
+            levels.resize(i - min_level + 1);
+        if (has_pgm(i) && pgms.size() <= size_t(i - min_index_level))
+            pgms.resize(i - min_index_level + 1);
+        return i;
+    }
 
-            // Empty this level and the corresponding index
+    /**
+     * Merges the buffer and the levels up to @p target into @p target, together with the sorted items in the range
+     * [first, last), which are more recent than those in the container.
+     */
+    void merge_into_level(uint8_t target, size_t size_hint, const Item *first = nullptr, const Item *last = nullptr) {
+        // The levels up to the target are merged in one pass, from the most recent to the least recent
+        uint8_t merge_limit = level(target).empty() ? target - 1 : target;
+        std::vector<std::pair<const Item *, const Item *>> runs;
+        runs.emplace_back(first, last);
+        for (uint8_t i = min_level; i <= merge_limit; ++i)
+            runs.emplace_back(level(i).data(), level(i).data() + level(i).size());
+
+        Level tmp(size_hint + level(target).size());
+        auto drop_tombstones = target == used_levels - 1;
+        auto out_end = drop_tombstones
+                       ? multiway_merge<true>(runs, tmp.begin())
+                       : multiway_merge<false>(runs, tmp.begin());
+        tmp.resize(std::distance(tmp.begin(), out_end));
+
+        // Empty the merged levels and the corresponding indexes
+        level(min_level).clear();
+        for (uint8_t i = min_level + 1; i <= merge_limit; ++i) {
             level(i).clear();
             if (i >= max_fully_allocated_level())
                 level(i).shrink_to_fit();
             if (has_pgm(i))
                 pgm(i) = PGMType();
         }
-
-        level(min_level).clear();
-        level(target) = std::move(alternate ? tmp_a : tmp_b);
+        level(target) = std::move(tmp);
 
         // Rebuild index, if needed
         if (has_pgm(target))
-            pgm(target) = PGMType(level(target).begin(), level(target).end());
+            pgm(target) = build_pgm(level(target));
+    }
+
+    PGMType build_pgm(Level &l) {
+        if constexpr (std::is_constructible_v<PGMType, decltype(l.begin()), decltype(l.end()), decltype(workspace) &>)
+            return PGMType(l.begin(), l.end(), workspace);
+        else
+            return PGMType(l.begin(), l.end());
     }
 
     void insert(const Item &new_item) {
@@ -126,23 +163,32 @@ class DynamicPGMIndex {
         }
 
         size_t slots_required = buffer_max_size + 1;
-        uint8_t i;
-        for (i = min_level + 1; i < used_levels; ++i) {
-            auto slots_left_in_level = max_size(i) - level(i).size();
-            if (slots_required <= slots_left_in_level)
-                break;
-            slots_required += level(i).size();
-        }
+        auto target = merge_target(slots_required);
+
+        // The buffer has room for the new item, which then takes part in the merge with the buffer
+        level(min_level).insert(insertion_point, new_item);
+        merge_into_level(target, slots_required);
+    }
+
+    void merge_batch(const Level &batch) {
+        if (batch.empty())
+            return;
 
-        auto need_new_level = i == used_levels;
-        if (need_new_level) {
-            ++used_levels;
-            levels.emplace_back();
-            if (i - min_index_level >= int(pgms.size()))
-                pgms.emplace_back();
+        auto &buffer = level(min_level);
+        if (buffer.size() + batch.size() <= buffer_max_size) {
+            std::vector<std::pair<const Item *, const Item *>> runs;
+            runs.emplace_back(batch.data(), batch.data() + batch.size());
+            runs.emplace_back(buffer.data(), buffer.data() + buffer.size());
+            Level tmp(buffer.size() + batch.size());
+            tmp.resize(std::distance(tmp.begin(), multiway_merge<false>(runs, tmp.begin())));
+            buffer.assign(tmp.begin(), tmp.end());
+            used_levels = used_levels == min_level ? min_level + 1 : used_levels;
+            return;
         }
 
-        pairwise_merge(new_item, i, slots_required, insertion_point);
+        size_t slots_required = buffer.size() + batch.size();
+        auto target = merge_target(slots_required);
+        merge_into_level(target, slots_required, batch.data(), batch.data() + batch.size());
     }
 
 public:
@@ -166,7 +212,8 @@ public:
           buffer_max_size(),
           used_levels(min_level),
           levels(),
-          pgms() {
+          pgms(),
+          workspace() {
         if (base < 2 || (base & (base - 1u)) != 0)
             throw std::invalid_argument("base must be a power of two");
 
@@ -174,7 +221,7 @@ public:
             buffer_max_size += max_size(j);
 
         levels.resize(32 - used_levels);
-        level(min_level).reserve(buffer_max_size);
+        level(min_level).reserve(buffer_max_size + 1);
         for (uint8_t i = min_level + 1; i < max_fully_allocated_level(); ++i)
             level(i).reserve(max_size(i));
     }
@@ -193,7 +240,7 @@ public:
         size_t n = std::distance(first, last);
         used_levels = std::max<uint8_t>(ceil_log_base(n), min_level) + 1;
         levels.resize(std::max<uint8_t>(used_levels, 32) - min_level + 1);
-        level(min_level).reserve(buffer_max_size);
+        level(min_level).reserve(buffer_max_size + 1);
         for (uint8_t i = min_level + 1; i < max_fully_allocated_level(); ++i)
             level(i).reserve(max_size(i));
 
@@ -217,7 +264,7 @@ public:
 
         if (has_pgm(used_levels - 1)) {
             pgms = decltype(pgms)(used_levels - min_index_level);
-            pgm(used_levels - 1) = PGMType(target.begin(), target.end());
+            pgm(used_levels - 1) = build_pgm(target);
         }
     }
 
@@ -235,6 +282,48 @@ public:
      */
     void erase(const K &key) { insert(Item(key)); }
 
+    /**
+     * Inserts or updates the elements in the sorted range [first, last) as if by calling @ref insert_or_assign on each
+     * of them in order, so of the elements with equal keys the last one is kept. The range is merged at once into the
+     * first level that can hold it, with a single index construction, so it takes time linear in its size and in the
+     * size of the merged levels.
+     * @tparam Iterator
+     * @param first, last the range containing the sorted key-value pairs to insert
+     */
+    template<typename Iterator>
+    void insert_batch(Iterator first, Iterator last) {
+        Level batch;
+        batch.reserve(std::distance(first, last));
+        for (; first != last; ++first) {
+            if (!batch.empty() && first->first < batch.back().first)
+                throw std::invalid_argument("Range is not sorted");
+            if (!batch.empty() && first->first == batch.back().first)
+                batch.back() = Item(first->first, first->second);
+            else
+                batch.emplace_back(first->first, first->second);
+        }
+        merge_batch(batch);
+    }
+
+    /**
+     * Removes the elements with keys in the sorted range [first, last), as if by calling @ref erase on each of them.
+     * The range is merged at once into the first level that can hold it, like in @ref insert_batch.
+     * @tparam Iterator
+     * @param first, last the range containing the sorted keys of the elements to remove
+     */
+    template<typename Iterator>
+    void erase_batch(Iterator first, Iterator last) {
+        Level batch;
+        batch.reserve(std::distance(first, last));
+        for (; first != last; ++first) {
+            if (!batch.empty() && *first < batch.back().first)
+                throw std::invalid_argument("Range is not sorted");
+            if (batch.empty() || batch.back().first != *first)
+                batch.emplace_back(*first);
+        }
+        merge_batch(batch);
+    }
+
     /**
      * Finds an element with key equivalent to @p key.
      * @param key key value of the element to search for
@@ -262,58 +351,68 @@ public:
     }
 
     /**
-     * Returns all the elements with key between and including @p lo and @p hi.
+     * Calls @p f on the elements with key between and including @p lo and @p hi, in key order, without copying them.
+     * Each level is searched once, and the elements are merged from the levels only as they are visited, so a visit
+     * that stops early does not pay for the rest of the range.
+     * @tparam F
      * @param lo lower endpoint of the range query
      * @param hi upper endpoint of the range query, must be greater than or equal to @p lo
-     * @return a vector of key-value pairs satisfying the range query
+     * @param f a function called as f(key, value), which may return false to stop the visit
      */
-    std::vector<std::pair<K, V>> range(const K &lo, const K &hi) const {
+    template<typename F>
+    void for_each_in_range(const K &lo, const K &hi, F f) const {
         if (lo > hi)
             throw std::invalid_argument("lo > hi");
 
-        Level tmp_a;
-        Level tmp_b;
-        auto alternate = true;
-
+        std::vector<std::pair<const Item *, const Item *>> runs;
         for (auto i = min_level; i < used_levels; ++i) {
             if (level(i).empty())
                 continue;
 
-            auto lo_first = level(i).begin();
-            auto lo_last = level(i).end();
-            auto hi_first = level(i).begin();
-            auto hi_last = level(i).end();
-            if (has_pgm(i)) {
-                auto range = pgm(i).search(lo);
-                lo_first = level(i).begin() + range.lo;
-                lo_last = level(i).begin() + range.hi;
-                range = pgm(i).search(hi);
-                hi_first = level(i).begin() + range.lo;
-                hi_last = level(i).begin() + range.hi;
+            // The endpoints outside the keys of the level are not searched, so a visit of all keys is a plain scan
+            auto it_lo = level(i).begin();
+            auto it_hi = level(i).end();
+            if (lo > level(i).front().first) {
+                auto lo_last = it_hi;
+                if (has_pgm(i)) {
+                    auto range = pgm(i).search(lo);
+                    it_lo = level(i).begin() + range.lo;
+                    lo_last = level(i).begin() + range.hi;
+                }
+                it_lo = lower_bound_bl(it_lo, lo_last, lo);
             }
-
-            auto it_lo = lower_bound_bl(lo_first, lo_last, lo);
-            auto it_hi = std::upper_bound(std::max(it_lo, hi_first), hi_last, hi);
-            auto range_size = std::distance(it_lo, it_hi);
-            if (range_size == 0)
-                continue;
-
-            auto tmp_size = (alternate ? tmp_a : tmp_b).size();
-            (alternate ? tmp_b : tmp_a).reserve(tmp_size + range_size);
-            auto tmp_it = (alternate ? tmp_a : tmp_b).begin();
-            auto out_it = (alternate ? tmp_b : tmp_a).begin();
-            tmp_size = std::distance(out_it, merge<false>(tmp_it, tmp_it + tmp_size, it_lo, it_hi, out_it));
-            (alternate ? tmp_b : tmp_a).resize(tmp_size);
-            alternate = !alternate;
+            if (hi < level(i).back().first) {
+                auto hi_first = it_lo;
+                if (has_pgm(i)) {
+                    auto range = pgm(i).search(hi);
+                    hi_first = std::max(it_lo, level(i).begin() + range.lo);
+                    it_hi = level(i).begin() + range.hi;
+                }
+                it_hi = std::upper_bound(hi_first, it_hi, hi);
+            }
+            auto data = level(i).data();
+            runs.emplace_back(data + (it_lo - level(i).begin()), data + (it_hi - level(i).begin()));
         }
 
+        multiway_visit<true>(runs, [&](const Item &x) {
+            if constexpr (std::is_same_v<std::invoke_result_t<F &, const K &, const V &>, bool>)
+                return f(x.first, x.second);
+            else {
+                f(x.first, x.second);
+                return true;
+            }
+        });
+    }
+
+    /**
+     * Returns all the elements with key between and including @p lo and @p hi.
+     * @param lo lower endpoint of the range query
+     * @param hi upper endpoint of the range query, must be greater than or equal to @p lo
+     * @return a vector of key-value pairs satisfying the range query
+     */
+    std::vector<std::pair<K, V>> range(const K &lo, const K &hi) const {
         std::vector<std::pair<K, V>> result;
-        result.reserve((alternate ? tmp_a : tmp_b).size());
-        auto first = (alternate ? tmp_a : tmp_b).begin();
-        auto last = (alternate ? tmp_a : tmp_b).end();
-        for (auto it = first; it != last; ++it)
-            if (!it->deleted())
-                result.emplace_back(it->first, it->second);
+        for_each_in_range(lo, hi, [&](const K &key, const V &value) { result.emplace_back(key, value); });
         return result;
     }
 
@@ -419,28 +518,122 @@ public:
 
 private:
 
-    template<bool SkipDeleted, typename In1, typename In2, typename OutIterator>
-    static OutIterator merge(In1 first1, In1 last1, In2 first2, In2 last2, OutIterator result) {
-        while (first1 != last1 && first2 != last2) {
-            if (*first2 < *first1) {
-                *result = *first2;
-                ++first2;
-                ++result;
-            } else if (*first1 < *first2) {
-                *result = *first1;
-                ++first1;
-                ++result;
-            } else if (SkipDeleted && first1->deleted()) {
-                ++first1;
-                ++first2;
-            } else {
-                *result = *first1;
-                ++first1;
-                ++first2;
-                ++result;
+    /**
+     * Merges the sorted runs, which are given from the most recent to the least recent, calling @p visit on each item
+     * in key order until it returns false. Of the items with equal keys, only the one in the most recent run is
+     * visited, and it is skipped if it is a tombstone and @p DropTombstones is true.
+     *
+     * The largest run is merged with the stream of items that a tournament tree merges from the other runs. So its
+     * items, which are most of the items when the runs are levels, cost one comparison each, as in a two-way merge.
+     *
+     * @return false if @p visit stopped the merge, true otherwise
+     */
+    template<bool DropTombstones, typename Visitor>
+    static bool multiway_visit(std::vector<std::pair<const Item *, const Item *>> &runs, Visitor visit) {
+        auto emit = [&](const Item &x) { return (DropTombstones && x.deleted()) || visit(x); };
+        auto emit_all = [&](const Item *first, const Item *last) {
+            for (; first != last; ++first)
+                if (!emit(*first))
+                    return false;
+            return true;
+        };
+
+        runs.erase(std::remove_if(runs.begin(), runs.end(), [](auto &r) { return r.first == r.second; }), runs.end());
+        if (runs.size() <= 2) {
+            // One or two runs are merged faster without the tree
+            auto no_run = std::pair<const Item *, const Item *>();
+            auto[first1, last1] = runs.size() > 0 ? runs[0] : no_run;
+            auto[first2, last2] = runs.size() > 1 ? runs[1] : no_run;
+            while (first1 != last1 && first2 != last2) {
+                if (first2->first < first1->first) {
+                    if (!emit(*first2++))
+                        return false;
+                } else {
+                    first2 += !(first1->first < first2->first);
+                    if (!emit(*first1++))
+                        return false;
+                }
+            }
+            return emit_all(first1, last1) && emit_all(first2, last2);
+        }
+
+        auto largest = size_t(std::max_element(runs.begin(), runs.end(), [](auto &a, auto &b) {
+            return a.second - a.first < b.second - b.first;
+        }) - runs.begin());
+        auto[big_first, big_last] = runs[largest];
+        runs.erase(runs.begin() + largest);
+
+        size_t remaining = 0;
+        internal::LoserTree<K> tree(runs.size());
+        for (size_t i = 0; i < runs.size(); ++i) {
+            tree.insert_start(&runs[i].first->first, i);
+            remaining += runs[i].second - runs[i].first;
+        }
+        tree.init();
+
+        auto pop = [&](size_t source) {
+            auto &[first, last] = runs[source];
+            ++first;
+            --remaining;
+            tree.delete_min_insert(first == last ? nullptr : &first->first);
+        };
+
+        // Returns the most recent of the smallest items of the other runs with its run, and skips those it shadows
+        auto next_other = [&]() -> std::pair<const Item *, size_t> {
+            auto source = tree.min_source();
+            auto item = runs[source].first;
+            if (item == runs[source].second) {
+                // The tree ranks exhausted runs as if they had the maximum key, which is the key of all the remaining
+                // items, one per run
+                source = std::find_if(runs.begin(), runs.end(), [](auto &r) { return r.first != r.second; })
+                         - runs.begin();
+                remaining = 0;
+                return {runs[source].first, source};
+            }
+
+            pop(source);
+            while (remaining > 0) {
+                auto next = tree.min_source();
+                if (runs[next].first == runs[next].second) {
+                    // An exhausted run ranks before the items with the maximum key of the older runs, so if the item
+                    // has the maximum key, these are all the remaining items and it shadows them
+                    if (item->first == std::numeric_limits<K>::max())
+                        remaining = 0;
+                    break;
+                }
+                if (runs[next].first->first != item->first)
+                    break;
+                pop(next);
             }
+            return {item, source};
+        };
+
+        while (true) {
+            auto[other, source] = next_other();
+            auto key = other->first;
+            while (big_first != big_last && big_first->first < key)
+                if (!emit(*big_first++))
+                    return false;
+            if (big_first != big_last && !(key < big_first->first)) {
+                if (!emit(source < largest ? *other : *big_first))
+                    return false;
+                ++big_first;
+            } else if (!emit(*other))
+                return false;
+            if (remaining == 0)
+                break;
         }
-        return std::copy(first2, last2, std::copy(first1, last1, result));
+        return emit_all(big_first, big_last);
+    }
+
+    /** Merges the sorted runs like @ref multiway_visit, writing each visited item once to @p result. */
+    template<bool DropTombstones, typename OutIterator>
+    static OutIterator multiway_merge(std::vector<std::pair<const Item *, const Item *>> &runs, OutIterator result) {
+        multiway_visit<DropTombstones>(runs, [&](const Item &x) {
+            *result++ = x;
+            return true;
+        });
+        return result;
     }
 
     template<class RandomIt>
@@ -710,4 +903,520 @@ public:
 
 #pragma pack(pop)
 
+/**
+ * A sorted associative container like @ref DynamicPGMIndex that many threads can search while other threads update it.
+ *
+ * The levels and their indexes are never modified once built. An update builds the levels it changes and publishes a
+ * new snapshot of the level set, which shares the other levels with the previous snapshot. Searches do not take locks
+ * and are never blocked by an update: they announce themselves in a striped counter, load the current snapshot and
+ * search it. Updates are serialized by a mutex. After publishing a snapshot, the writer waits until the searches that
+ * may still read the previous snapshot are finished, then frees it, as in read-copy-update.
+ *
+ * An update copies the buffer level, so it takes O(buffer size) more time than in @ref DynamicPGMIndex. This suits
+ * workloads with many more searches than updates.
+ *
+ * By default, the update that finds the buffer full merges it into the levels below, which may take a long time on a
+ * large container. With background compaction, that update seals the full buffer and starts a new one instead, and a
+ * worker thread merges the sealed buffers into the levels and rebuilds their indexes. The sealed buffers are searched
+ * until they are merged. When the given number of sealed buffers is waiting, the updates that fill the buffer block
+ * until the worker merges one of them.
+ *
+ * @tparam K the type of a key
+ * @tparam V the type of a value
+ * @tparam PGMType the type of @ref PGMIndex to use in the container
+ */
+template<typename K, typename V, typename PGMType = PGMIndex<K, 16>>
+class ConcurrentDynamicPGMIndex {
+    using Item = typename DynamicPGMIndex<K, V, PGMType>::Item;
+    using Level = typename DynamicPGMIndex<K, V, PGMType>::Level;
+    using Sequential = DynamicPGMIndex<K, V, PGMType>;
+
+    struct Snapshot {
+        uint8_t used_levels;                              ///< Equal to 1 + last level that is not empty, or min_level.
+        std::vector<std::shared_ptr<const Level>> levels; ///< (i-min_level)th element is the ith level, null if empty.
+        std::vector<std::shared_ptr<const PGMType>> pgms; ///< (i-min_index_level)th element is the index of level i.
+        std::vector<std::shared_ptr<const Level>> sealed; ///< The full buffers waiting to be merged, newest first.
+    };
+
+    struct alignas(64) ReaderSlot {
+        std::atomic<size_t> readers[2]; ///< Number of searches started in an epoch with the given parity.
+    };
+
+    /** Announces a search in the slot of the calling thread for as long as it is alive. */
+    class ReadGuard {
+        std::atomic<size_t> *readers;
+
+    public:
+        explicit ReadGuard(const ConcurrentDynamicPGMIndex &c) {
+            static thread_local size_t slot = std::hash<std::thread::id>()(std::this_thread::get_id()) % reader_slots;
+            while (true) {
+                auto e = c.epoch.load();
+                readers = &c.slots[slot].readers[e & 1];
+                readers->fetch_add(1);
+                if (c.epoch.load() == e)
+                    break;
+                readers->fetch_sub(1);
+            }
+        }
+
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard &operator=(const ReadGuard &) = delete;
+        ~ReadGuard() { readers->fetch_sub(1, std::memory_order_release); }
+    };
+
+    static constexpr size_t reader_slots = 64;
+
+    const uint8_t base;                                 ///< base^i is the maximum size of the ith level.
+    const uint8_t min_level;                            ///< Levels 0..min_level are combined into one large level.
+    const uint8_t min_index_level;                      ///< Minimum level on which an index is constructed.
+    const size_t max_sealed_buffers;                    ///< Sealed buffers that block the updates, 0 = no compactor.
+    size_t buffer_max_size;                             ///< Size of the combined upper levels.
+    std::atomic<const Snapshot *> current;              ///< The snapshot that new searches read.
+    std::atomic<size_t> epoch;                          ///< Incremented every time a snapshot is replaced.
+    mutable std::array<ReaderSlot, reader_slots> slots; ///< Striped counters of the searches in progress.
+    std::mutex write_mutex;                             ///< Serializes the updates.
+    std::condition_variable sealed_added;               ///< Signals the compactor that a buffer was sealed.
+    std::condition_variable sealed_merged;              ///< Signals the updates that a sealed buffer was merged.
+    bool stopping;                                      ///< true iff the compactor must exit.
+    std::thread compactor;                              ///< The thread that merges the sealed buffers.
+    SegmentationWorkspace<K> workspace;                 ///< The memory reused by the constructions of the indexes.
+
+    size_t max_size(uint8_t level) const { return size_t(1) << (level * Sequential::ceil_log2(base)); }
+    bool has_pgm(uint8_t level) const { return level >= min_index_level; }
+
+    uint8_t ceil_log_base(size_t n) const {
+        return (Sequential::ceil_log2(n) + Sequential::ceil_log2(base) - 1) / Sequential::ceil_log2(base);
+    }
+
+    const Level *level(const Snapshot &s, uint8_t level) const {
+        auto i = size_t(level - min_level);
+        return i < s.levels.size() && s.levels[i] && !s.levels[i]->empty() ? s.levels[i].get() : nullptr;
+    }
+
+    /**
+     * Calls f(level, pgm) on the non-empty levels and sealed buffers of @p s, from the most recent to the least recent,
+     * until it returns false. The pgm argument is null if the level has no index.
+     */
+    template<typename F>
+    void for_each_level(const Snapshot &s, F f) const {
+        if (auto l = level(s, min_level); l && !f(*l, nullptr))
+            return;
+        for (auto &l : s.sealed)
+            if (!f(*l, nullptr))
+                return;
+        for (auto i = min_level + 1; i < s.used_levels; ++i)
+            if (auto l = level(s, i); l && !f(*l, has_pgm(i) ? s.pgms[i - min_index_level].get() : nullptr))
+                return;
+    }
+
+    /** Returns the range of the level @p l where @p key can be found, or the whole level if it has no index. */
+    static std::pair<typename Level::const_iterator, typename Level::const_iterator>
+    search_level(const Level &l, const PGMType *pgm, const K &key) {
+        if (!pgm)
+            return {l.begin(), l.end()};
+        auto range = pgm->search(key);
+        return {l.begin() + range.lo, l.begin() + range.hi};
+    }
+
+    std::shared_ptr<const PGMType> build_pgm(const Level &l) {
+        if constexpr (std::is_constructible_v<PGMType, decltype(l.begin()), decltype(l.end()), decltype(workspace) &>)
+            return std::make_shared<const PGMType>(l.begin(), l.end(), workspace);
+        else
+            return std::make_shared<const PGMType>(l.begin(), l.end());
+    }
+
+    /** Makes @p next visible to new searches, waits for the searches on the previous snapshot, and frees it. */
+    void publish(std::unique_ptr<Snapshot> next) {
+        std::unique_ptr<const Snapshot> previous(current.exchange(next.release()));
+        auto e = epoch.fetch_add(1);
+        for (auto &slot : slots)
+            while (slot.readers[e & 1].load() != 0)
+                std::this_thread::yield();
+    }
+
+    /**
+     * Merges the sorted @p items, which are more recent than the levels of @p s, into the first level below the buffer
+     * that can hold them together with the levels above it, and rebuilds its index. The buffer is not changed.
+     */
+    void merge_into_levels(Snapshot &s, const Level &items) {
+        size_t slots_required = items.size();
+        uint8_t target;
+        for (target = min_level + 1; target < s.used_levels; ++target) {
+            auto size = level(s, target) ? level(s, target)->size() : 0;
+            if (slots_required <= max_size(target) - size)
+                break;
+            slots_required += size;
+        }
+
+        if (target == s.used_levels) {
+            ++s.used_levels;
+            s.levels.resize(std::max<size_t>(s.levels.size(), target - min_level + 1));
+        }
+
+        std::vector<std::pair<const Item *, const Item *>> runs;
+        runs.emplace_back(items.data(), items.data() + items.size());
+        size_t size = items.size();
+        for (uint8_t i = min_level + 1; i <= target; ++i) {
+            if (auto l = level(s, i)) {
+                runs.emplace_back(l->data(), l->data() + l->size());
+                size += l->size();
+            }
+        }
+
+        auto tmp = std::make_shared<Level>(size);
+        auto out_end = target == s.used_levels - 1
+                       ? Sequential::template multiway_merge<true>(runs, tmp->begin())
+                       : Sequential::template multiway_merge<false>(runs, tmp->begin());
+        tmp->resize(std::distance(tmp->begin(), out_end));
+
+        for (uint8_t i = min_level + 1; i < target; ++i) {
+            s.levels[i - min_level] = nullptr;
+            if (has_pgm(i) && size_t(i - min_index_level) < s.pgms.size())
+                s.pgms[i - min_index_level] = nullptr;
+        }
+        std::shared_ptr<const Level> merged = std::move(tmp);
+        if (has_pgm(target)) {
+            s.pgms.resize(std::max<size_t>(s.pgms.size(), target - min_index_level + 1));
+            s.pgms[target - min_index_level] = build_pgm(*merged);
+        }
+        s.levels[target - min_level] = std::move(merged);
+    }
+
+    void insert(const Item &new_item) {
+        std::unique_lock<std::mutex> lock(write_mutex);
+        while (true) {
+            auto &s = *current.load();
+            static const Level no_items;
+            auto &buffer = level(s, min_level) ? *level(s, min_level) : no_items;
+            auto insertion_point = Sequential::lower_bound_bl(buffer.begin(), buffer.end(), new_item);
+            auto replace = insertion_point != buffer.end() && *insertion_point == new_item;
+            auto full = !replace && buffer.size() == buffer_max_size;
+            if (full && max_sealed_buffers > 0 && s.sealed.size() == max_sealed_buffers) {
+                sealed_merged.wait(lock);
+                continue;
+            }
+
+            auto seal = full && max_sealed_buffers > 0;
+            auto l = std::make_shared<Level>();
+            l->reserve(seal ? 1 : buffer.size() + 1);
+            if (!seal)
+                l->insert(l->end(), buffer.begin(), insertion_point);
+            l->push_back(new_item);
+            if (!seal)
+                l->insert(l->end(), insertion_point + replace, buffer.end());
+
+            auto next = std::make_unique<Snapshot>(s);
+            next->used_levels = std::max<uint8_t>(s.used_levels, min_level + 1);
+            if (seal)
+                next->sealed.insert(next->sealed.begin(), s.levels[0]);
+            if (full && !seal)
+                merge_into_levels(*next, *l);
+            next->levels[0] = full && !seal ? nullptr : std::move(l);
+            publish(std::move(next));
+            if (seal)
+                sealed_added.notify_one();
+            return;
+        }
+    }
+
+    /** The loop of the compactor, which merges the oldest sealed buffer into the levels while the updates go on. */
+    void compact() {
+        std::unique_lock<std::mutex> lock(write_mutex);
+        while (true) {
+            sealed_added.wait(lock, [&] { return stopping || !current.load()->sealed.empty(); });
+            if (stopping)
+                return;
+
+            // Only the compactor changes the levels below the buffer, so they can be merged without holding the lock
+            Snapshot levels = *current.load();
+            auto oldest = levels.sealed.back();
+            lock.unlock();
+            merge_into_levels(levels, *oldest);
+            lock.lock();
+
+            auto next = std::make_unique<Snapshot>(*current.load());
+            next->levels.resize(std::max(next->levels.size(), levels.levels.size()));
+            std::copy(levels.levels.begin() + 1, levels.levels.end(), next->levels.begin() + 1);
+            next->pgms = std::move(levels.pgms);
+            next->used_levels = std::max(next->used_levels, levels.used_levels);
+            next->sealed.pop_back();
+            publish(std::move(next));
+            sealed_merged.notify_all();
+        }
+    }
+
+public:
+
+    using key_type = K;
+    using mapped_type = V;
+    using size_type = size_t;
+
+    /**
+     * Constructs an empty container.
+     * @param base determines the size of the ith level as base^i
+     * @param buffer_level determines the size of level 0, equal to the sum of base^i for i = 0, ..., buffer_level
+     * @param index_level the minimum level at which an index is constructed to speed up searches
+     * @param max_sealed_buffers the number of sealed buffers at which the updates block, or 0 to merge the full buffer
+     * in the update that fills it rather than in a background thread
+     */
+    ConcurrentDynamicPGMIndex(uint8_t base = 8, uint8_t buffer_level = 0, uint8_t index_level = 0,
+                              size_t max_sealed_buffers = 0)
+        : base(base),
+          min_level(buffer_level ? buffer_level : ceil_log_base(128) - (base == 2)),
+          min_index_level(std::max<size_t>(min_level + 1, index_level ? index_level : ceil_log_base(size_t(1) << 24))),
+          max_sealed_buffers(max_sealed_buffers),
+          buffer_max_size(),
+          current(new Snapshot{min_level, std::vector<std::shared_ptr<const Level>>(1), {}, {}}),
+          epoch(),
+          slots(),
+          write_mutex(),
+          sealed_added(),
+          sealed_merged(),
+          stopping(false),
+          compactor(),
+          workspace() {
+        if (base < 2 || (base & (base - 1u)) != 0)
+            throw std::invalid_argument("base must be a power of two");
+
+        for (auto j = 0; j <= min_level; ++j)
+            buffer_max_size += max_size(j);
+
+        if (max_sealed_buffers > 0)
+            compactor = std::thread(&ConcurrentDynamicPGMIndex::compact, this);
+    }
+
+    /**
+     * Constructs the container on the sorted data in the range [first, last).
+     * @tparam Iterator
+     * @param first, last the range containing the sorted elements to be indexed
+     * @param base determines the size of the ith level as base^i
+     * @param buffer_level determines the size of level 0, equal to the sum of base^i for i = 0, ..., buffer_level
+     * @param index_level the minimum level at which an index is constructed to speed up searches
+     * @param max_sealed_buffers the number of sealed buffers at which the updates block, or 0 to merge the full buffer
+     * in the update that fills it rather than in a background thread
+     */
+    template<typename Iterator, typename = std::enable_if_t<!std::is_integral_v<Iterator>>>
+    ConcurrentDynamicPGMIndex(Iterator first, Iterator last, uint8_t base = 8, uint8_t buffer_level = 0,
+                              uint8_t index_level = 0, size_t max_sealed_buffers = 0)
+        : ConcurrentDynamicPGMIndex(base, buffer_level, index_level, max_sealed_buffers) {
+        if (first == last)
+            return;
+
+        // Copy only the first of each group of pairs with same key value
+        auto target = std::max<uint8_t>(ceil_log_base(std::distance(first, last)), min_level);
+        auto l = std::make_shared<Level>();
+        l->emplace_back(first->first, first->second);
+        while (++first != last) {
+            if (first->first < l->back().first)
+                throw std::invalid_argument("Range is not sorted");
+            if (first->first != l->back().first)
+                l->emplace_back(first->first, first->second);
+        }
+
+        std::lock_guard<std::mutex> lock(write_mutex);
+        auto next = std::make_unique<Snapshot>();
+        next->used_levels = target + 1;
+        next->levels.resize(target - min_level + 1);
+        if (has_pgm(target)) {
+            next->pgms.resize(target - min_index_level + 1);
+            next->pgms.back() = build_pgm(*l);
+        }
+        next->levels.back() = std::move(l);
+        publish(std::move(next));
+    }
+
+    ConcurrentDynamicPGMIndex(const ConcurrentDynamicPGMIndex &) = delete;
+    ConcurrentDynamicPGMIndex &operator=(const ConcurrentDynamicPGMIndex &) = delete;
+
+    ~ConcurrentDynamicPGMIndex() {
+        if (compactor.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(write_mutex);
+                stopping = true;
+            }
+            sealed_added.notify_one();
+            compactor.join();
+        }
+        delete current.load();
+    }
+
+    /**
+     * Inserts an element into the container if @p key does not exists in the container. If @p key already exists, the
+     * corresponding value is updated with @p value. The searches that start after this function returns see the update.
+     * @param key element key to insert or update
+     * @param value element value to insert
+     */
+    void insert_or_assign(const K &key, const V &value) { insert(Item(key, value)); }
+
+    /**
+     * Removes the specified element from the container. The searches that start after this function returns see the
+     * update.
+     * @param key key value of the element to remove
+     */
+    void erase(const K &key) { insert(Item(key)); }
+
+    /**
+     * Waits until the background compaction has merged all the sealed buffers into the levels. It returns immediately
+     * if the container has no background compaction.
+     */
+    void wait_for_compaction() {
+        std::unique_lock<std::mutex> lock(write_mutex);
+        sealed_merged.wait(lock, [&] { return current.load()->sealed.empty(); });
+    }
+
+    /**
+     * Finds the value of the element with key equivalent to @p key.
+     * @param key key value of the element to search for
+     * @return the value of the element with key equivalent to @p key, or an empty optional if there is no such element
+     */
+    std::optional<V> find(const K &key) const {
+        ReadGuard guard(*this);
+        std::optional<V> result;
+        for_each_level(*current.load(), [&](const Level &l, const PGMType *pgm) {
+            auto[first, last] = search_level(l, pgm, key);
+            auto it = Sequential::lower_bound_bl(first, last, key);
+            if (it == l.end() || it->first != key)
+                return true;
+            if (!it->deleted())
+                result = it->second;
+            return false;
+        });
+        return result;
+    }
+
+    /**
+     * Checks if there is an element with key equivalent to @p key in the container.
+     * @param key key value of the element to search for
+     * @return true if there is such an element, false otherwise
+     */
+    bool contains(const K &key) const { return find(key).has_value(); }
+
+    /**
+     * Returns the number of elements with key that compares equal to the specified argument key, which is either 1
+     * or 0 since this container does not allow duplicates.
+     * @param key key value of the elements to count
+     * @return number of elements with the given key, which is either 1 or 0.
+     */
+    size_t count(const K &key) const { return contains(key) ? 1 : 0; }
+
+    /**
+     * Returns the first element whose key is not less than (i.e. greater or equal to) @p key.
+     * @param key key value to compare the elements to
+     * @return the key-value pair of the element with key not less than @p key, or an empty optional if there is none
+     */
+    std::optional<std::pair<K, V>> lower_bound(const K &key) const {
+        ReadGuard guard(*this);
+        const Item *lb = nullptr;
+        std::set<K> deleted;
+
+        for_each_level(*current.load(), [&](const Level &l, const PGMType *pgm) {
+            auto[first, last] = search_level(l, pgm, key);
+            for (auto it = Sequential::lower_bound_bl(first, last, key);
+                 it != l.end() && (!lb || it->first < lb->first); ++it) {
+                if (it->deleted())
+                    deleted.emplace(it->first);
+                else if (deleted.find(it->first) == deleted.end()) {
+                    lb = &*it;
+                    break;
+                }
+            }
+            return !lb || lb->first != key;
+        });
+
+        return lb ? std::optional<std::pair<K, V>>({lb->first, lb->second}) : std::nullopt;
+    }
+
+    /**
+     * Calls @p f on the elements with key between and including @p lo and @p hi, in key order, without copying them,
+     * like @ref DynamicPGMIndex::for_each_in_range. The visit reads a single snapshot, and an update that replaces it
+     * waits for the visit to end, so @p f should not take long or update the container.
+     * @tparam F
+     * @param lo lower endpoint of the range query
+     * @param hi upper endpoint of the range query, must be greater than or equal to @p lo
+     * @param f a function called as f(key, value), which may return false to stop the visit
+     */
+    template<typename F>
+    void for_each_in_range(const K &lo, const K &hi, F f) const {
+        if (lo > hi)
+            throw std::invalid_argument("lo > hi");
+
+        ReadGuard guard(*this);
+        std::vector<std::pair<const Item *, const Item *>> runs;
+        for_each_level(*current.load(), [&](const Level &l, const PGMType *pgm) {
+            if (l.empty())
+                return true;
+            auto it_lo = l.begin();
+            auto it_hi = l.end();
+            if (lo > l.front().first) {
+                auto[lo_first, lo_last] = search_level(l, pgm, lo);
+                it_lo = Sequential::lower_bound_bl(lo_first, lo_last, lo);
+            }
+            if (hi < l.back().first) {
+                auto[hi_first, hi_last] = search_level(l, pgm, hi);
+                it_hi = std::upper_bound(std::max(it_lo, hi_first), hi_last, hi);
+            }
+            runs.emplace_back(l.data() + (it_lo - l.begin()), l.data() + (it_hi - l.begin()));
+            return true;
+        });
+
+        Sequential::template multiway_visit<true>(runs, [&](const Item &x) {
+            if constexpr (std::is_same_v<std::invoke_result_t<F &, const K &, const V &>, bool>)
+                return f(x.first, x.second);
+            else {
+                f(x.first, x.second);
+                return true;
+            }
+        });
+    }
+
+    /**
+     * Returns all the elements with key between and including @p lo and @p hi.
+     * @param lo lower endpoint of the range query
+     * @param hi upper endpoint of the range query, must be greater than or equal to @p lo
+     * @return a vector of key-value pairs satisfying the range query
+     */
+    std::vector<std::pair<K, V>> range(const K &lo, const K &hi) const {
+        std::vector<std::pair<K, V>> result;
+        for_each_in_range(lo, hi, [&](const K &key, const V &value) { result.emplace_back(key, value); });
+        return result;
+    }
+
+    /**
+     * Returns the number of elements in the container. It takes time linear in the size of the levels.
+     * @return the number of elements in the container
+     */
+    size_t size() const {
+        size_t count = 0;
+        for_each_in_range(std::numeric_limits<K>::lowest(), std::numeric_limits<K>::max(),
+                          [&](const K &, const V &) { ++count; });
+        return count;
+    }
+
+    /**
+     * Checks if the container has no elements.
+     * @return true if the container is empty, false otherwise
+     */
+    bool empty() const {
+        auto found = false;
+        for_each_in_range(std::numeric_limits<K>::lowest(), std::numeric_limits<K>::max(),
+                          [&](const K &, const V &) { return !(found = true); });
+        return !found;
+    }
+
+    /**
+     * Returns the size of the levels, sealed buffers and indexes in the current snapshot in bytes.
+     * @return the size of the container in bytes
+     */
+    size_t size_in_bytes() const {
+        ReadGuard guard(*this);
+        auto &s = *current.load();
+        size_t bytes = (s.levels.size() + s.sealed.size()) * sizeof(Level);
+        for_each_level(s, [&](const Level &l, const PGMType *pgm) {
+            bytes += l.size() * sizeof(Item) + (pgm ? pgm->size_in_bytes() : 0);
+            return true;
+        });
+        return bytes;
+    }
+};
+
 }
\ No newline at end of file
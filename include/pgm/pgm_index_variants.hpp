@@ -17,7 +17,9 @@
 
 #include "morton_nd.hpp"
 #include "piecewise_linear_model.hpp"
+#include "piecewise_polynomial_model.hpp"
 #include "pgm_index.hpp"
+#include "pgm_table.hpp"
 #include "sdsl.hpp"
 
 #include <fcntl.h>
@@ -34,6 +36,7 @@
 #include <iterator>
 #include <limits>
 #include <numeric>
+#include <queue>
 #include <stdexcept>
 #include <string>
 #include <tuple>
@@ -65,8 +68,10 @@ using OneLevelPGMIndex = PGMIndex<K, Epsilon, 0, Floating>;
  * @tparam Epsilon controls the size of the returned search range
  * @tparam EpsilonRecursive controls the size of the search range in the internal structure
  * @tparam Floating the floating-point type to use for slopes
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex
  */
-template<typename K, size_t Epsilon, size_t EpsilonRecursive = 4, typename Floating = float>
+template<typename K, size_t Epsilon, size_t EpsilonRecursive = 4, typename Floating = float,
+         typename Instrumentation = NoInstrumentation>
 class CompressedPGMIndex {
     static_assert(Epsilon > 0);
     struct CompressedLevel;
@@ -176,38 +181,62 @@ public:
     ApproxPos search(const K &key) const {
         auto k = std::max(first_key, key);
 
+        auto predict = [&](const CompressedLevel &level, size_t i) {
+            size_t pos = level(slopes_table, i, k);
+            size_t bound = level.get_intercept(i + 1);
+            internal::record<Instrumentation>([&](auto &c) { c.clipped += pos > bound; });
+            return std::min(pos, bound);
+        };
+        auto result = [&](size_t pos) {
+            auto lo = PGM_SUB_EPS(pos, Epsilon);
+            auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+            internal::record<Instrumentation>([&](auto &c) {
+                ++c.searches;
+                c.window += hi - lo;
+            });
+            return ApproxPos{pos, lo, hi};
+        };
+
         if constexpr (EpsilonRecursive == 0) {
             auto &level = levels.front();
+            internal::record<Instrumentation>([&](auto &c) {
+                ++c.levels;
+                c.segments_scanned += internal::binary_search_probes(level.size());
+            });
             auto it = std::upper_bound(level.keys.begin(), level.keys.begin() + level.size(), key);
-            auto i = std::distance(level.keys.begin(), it) - 1;
-            auto pos = std::min<size_t>(level(slopes_table, i, k), level.get_intercept(i + 1));
-            auto lo = PGM_SUB_EPS(pos, Epsilon);
-            auto hi = PGM_ADD_EPS(pos, Epsilon, n);
-            return {pos, lo, hi};
+            return result(predict(level, std::distance(level.keys.begin(), it) - 1));
         }
 
         auto p = int64_t(root_slope * (k - first_key)) + root_intercept;
-        auto pos = std::min<size_t>(p > 0 ? size_t(p) : 0ull, root_range);
+        auto pos = p > 0 ? size_t(p) : size_t(0);
+        internal::record<Instrumentation>([&](auto &c) { c.clipped += pos > root_range; });
+        pos = std::min(pos, root_range);
 
         for (const auto &level : levels) {
             auto lo = level.keys.begin() + PGM_SUB_EPS(pos, EpsilonRecursive + 1);
 
             static constexpr size_t linear_search_threshold = 8 * 64 / sizeof(K);
             if constexpr (EpsilonRecursive <= linear_search_threshold) {
+                auto start = lo;
                 for (; *std::next(lo) <= key; ++lo)
                     continue;
+                internal::record<Instrumentation>([&](auto &c) {
+                    ++c.levels;
+                    c.segments_scanned += std::distance(start, lo) + 1;
+                });
             } else {
                 auto hi = level.keys.begin() + PGM_ADD_EPS(pos, EpsilonRecursive, level.size());
-                auto it = std::prev(std::upper_bound(lo, hi, k));
+                internal::record<Instrumentation>([&](auto &c) {
+                    ++c.levels;
+                    c.segments_scanned += internal::binary_search_probes(std::distance(lo, hi));
+                });
+                lo = std::prev(std::upper_bound(lo, hi, k));
             }
 
-            auto i = std::distance(level.keys.begin(), lo);
-            pos = std::min<size_t>(level(slopes_table, i, k), level.get_intercept(i + 1));
+            pos = predict(level, std::distance(level.keys.begin(), lo));
         }
 
-        auto lo = PGM_SUB_EPS(pos, Epsilon);
-        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
-        return {pos, lo, hi};
+        return result(pos);
     }
 
     /**
@@ -282,8 +311,8 @@ private:
     }
 };
 
-template<typename K, size_t Epsilon, size_t EpsilonRecursive, typename Floating>
-struct CompressedPGMIndex<K, Epsilon, EpsilonRecursive, Floating>::CompressedLevel {
+template<typename K, size_t Epsilon, size_t EpsilonRecursive, typename Floating, typename Instrumentation>
+struct CompressedPGMIndex<K, Epsilon, EpsilonRecursive, Floating, Instrumentation>::CompressedLevel {
     std::vector<K> keys;                       ///< The keys of the segment in this level.
     sdsl::int_vector<> slopes_map;             ///< The ith element is an index into slopes_table.
     int64_t intercept_offset;                  ///< An offset to make the intercepts start from 0 in the bitvector.
@@ -366,8 +395,11 @@ struct CompressedPGMIndex<K, Epsilon, EpsilonRecursive, Floating>::CompressedLev
  * @tparam TopLevelSize the number of cells allocated for the top-level table
  * @tparam TopLevelBitSize the bit-size of the cells in the top-level table
  * @tparam Floating the floating-point type to use for slopes
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex. The lookup in the
+ * top-level table and the search in its bucket count as one level
  */
-template<typename K, size_t Epsilon, size_t TopLevelSize, uint8_t TopLevelBitSize = 32, typename Floating = float>
+template<typename K, size_t Epsilon, size_t TopLevelSize, uint8_t TopLevelBitSize = 32, typename Floating = float,
+         typename Instrumentation = NoInstrumentation>
 class BucketingPGMIndex {
 protected:
     static_assert(Epsilon > 0 && TopLevelSize > 0);
@@ -423,6 +455,10 @@ protected:
             j = (key - first_key) / step;
         auto first = segments.begin() + top_level[j];
         auto last = segments.begin() + top_level[j + 1];
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.levels;
+            c.segments_scanned += 1 + internal::binary_search_probes(std::distance(first, last));
+        });
         return std::prev(std::upper_bound(first, last, key));
     }
 
@@ -465,14 +501,19 @@ public:
      * @return a struct with the approximate position and bounds of the range
      */
     ApproxPos search(const K &key) const {
+        internal::record<Instrumentation>([](auto &c) { ++c.searches; });
         if (__builtin_expect(key < first_key, 0))
             return {0, 0, 0};
         if (__builtin_expect(key > last_key, 0))
             return {n, n, n};
         auto it = segment_for_key(key);
-        auto pos = std::min<size_t>((*it)(key), std::next(it)->intercept);
+        size_t pos = (*it)(key);
+        size_t bound = std::next(it)->intercept;
+        internal::record<Instrumentation>([&](auto &c) { c.clipped += pos > bound; });
+        pos = std::min(pos, bound);
         auto lo = PGM_SUB_EPS(pos, Epsilon);
         auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        internal::record<Instrumentation>([&](auto &c) { c.window += hi - lo; });
         return {pos, lo, hi};
     }
 
@@ -508,8 +549,11 @@ public:
  * @tparam K the type of the indexed keys
  * @tparam Epsilon controls the size of the returned search range
  * @tparam Floating the floating-point type to use for slopes
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex. The predecessor
+ * search in the Elias-Fano structure counts as one level, which scans a segment for the select and one for each key
+ * compared in the bucket of the select
  */
-template<typename K, size_t Epsilon = 64, typename Floating = float>
+template<typename K, size_t Epsilon = 64, typename Floating = float, typename Instrumentation = NoInstrumentation>
 class EliasFanoPGMIndex {
 protected:
     static_assert(Epsilon > 0);
@@ -583,10 +627,21 @@ public:
      */
     ApproxPos search(const K &key) const {
         auto k = std::max(first_key, key);
+        internal::record<Instrumentation>([](auto &c) {
+            ++c.levels;
+            ++c.segments_scanned;
+        });
         auto[r, origin] = pred(k - first_key);
-        auto pos = std::min<size_t>(segments[r](origin + first_key, k), segments[r + 1].intercept);
+        size_t pos = segments[r](origin + first_key, k);
+        size_t bound = segments[r + 1].intercept;
+        internal::record<Instrumentation>([&](auto &c) { c.clipped += pos > bound; });
+        pos = std::min(pos, bound);
         auto lo = PGM_SUB_EPS(pos, Epsilon);
         auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.searches;
+            c.window += hi - lo;
+        });
         return {pos, lo, hi};
     }
 
@@ -635,197 +690,1384 @@ private:
                 return {0, ef.low[rank_low] + (high_val < ef.wl)};
             --sel_high;
             --rank_low;
+            internal::record<Instrumentation>([](auto &c) { ++c.segments_scanned; });
         } while (ef.high[sel_high] and ef.low[rank_low] >= val_low);
         auto h = ef.high[sel_high] ? high_val : sdsl::bits::prev(ef.high.data(), sel_high) - rank_low;
         return {rank_low, ef.low[rank_low] + (h << ef.wl)};
     }
 };
 
+namespace internal {
+
 /**
- * A disk-backed container storing a sorted sequence of numbers and a @ref PGMIndex for fast search operations.
+ * The slope and intercept of a segment of a @ref PGMIndex, for the variants that store the key of each segment in a
+ * separate array and pass it to the prediction as its origin.
+ */
+template<typename K, typename Floating, typename Intercept>
+struct SegmentData {
+    Floating slope;      ///< The slope of the segment.
+    Intercept intercept; ///< The intercept of the segment.
+
+    SegmentData() = default;
+
+    template<typename Segment>
+    SegmentData(const Segment &s) : slope(s.slope), intercept(s.intercept) {}
+
+    inline size_t operator()(const K &origin, const K &k) const {
+        auto pos = int64_t(slope * (k - origin)) + intercept;
+        return pos > 0 ? size_t(pos) : 0ull;
+    }
+};
+
+} // namespace internal
+
+/**
+ * A variant of @ref PGMIndex that stores the segments as a structure of arrays.
+ *
+ * The keys of the segments are kept in an array separate from their slopes and intercepts, so that the search of the
+ * segment responsible for a key in the window of a level only touches the cache lines containing the keys, and it is
+ * performed with a single branchless SIMD count over the whole window rather than with a linear scan. This makes the
+ * cost of a level almost insensitive to @p EpsilonRecursive, which can then be increased to reduce the height.
  *
  * @tparam K the type of the indexed keys
  * @tparam Epsilon controls the size of the returned search range
  * @tparam EpsilonRecursive controls the size of the search range in the internal structure
  * @tparam Floating the floating-point type to use for slopes
+ * @tparam Intercept the signed integer type to use for intercepts, which must be able to represent @c n
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex
  */
-template<typename K, size_t Epsilon, size_t EpsilonRecursive = 4, typename Floating = float>
-class MappedPGMIndex : public PGMIndex<K, Epsilon, EpsilonRecursive, Floating> {
-    using base = PGMIndex<K, Epsilon, EpsilonRecursive, Floating>;
-    K *data;
-    size_t file_bytes;
-    size_t header_bytes;
+template<typename K, size_t Epsilon = 64, size_t EpsilonRecursive = 4, typename Floating = float,
+         typename Intercept = int32_t, typename Instrumentation = NoInstrumentation>
+class SoAPGMIndex {
+protected:
+    static_assert(Epsilon > 0);
 
-public:
+    using Segment = typename PGMIndex<K, Epsilon, EpsilonRecursive, Floating, Intercept>::Segment;
+
+    using SegmentData = internal::SegmentData<K, Floating, Intercept>;
+
+    size_t n;                           ///< The number of elements this index was built on.
+    K first_key;                        ///< The smallest element.
+    std::vector<K> keys;                ///< The first key of each segment, level by level.
+    std::vector<SegmentData> segments;  ///< The slope and intercept of each segment, parallel to keys.
+    std::vector<size_t> levels_offsets; ///< The starting position of each level in keys[], in reverse order.
 
     /**
-     * Constructs a new disk-backed container on the sorted keys in the range [first, last).
-     * @param first, last the range containing the sorted keys to copy
-     * @param out_filename the name of the output file
+     * Returns the position of the segment responsible for a given key, that is, the rightmost segment having key <= the
+     * sought key.
+     * @param key the value of the element to search for
+     * @return the position in keys[] of the segment responsible for the given key
      */
-    template<class RandomIt>
-    MappedPGMIndex(RandomIt first, RandomIt last, const std::string &out_filename)
-        : base(first, last),
-          data(),
-          file_bytes(),
-          header_bytes() {
-        serialize_and_map(first, last, out_filename);
+    size_t segment_for_key(const K &key) const {
+        if constexpr (EpsilonRecursive == 0) {
+            internal::record<Instrumentation>([&](auto &c) {
+                ++c.levels;
+                c.segments_scanned += internal::binary_search_probes(segments_count());
+            });
+            auto it = std::upper_bound(keys.begin(), keys.begin() + segments_count(), key);
+            return std::distance(keys.begin(), it) - 1;
+        }
+
+        auto i = *(levels_offsets.end() - 2);
+        for (auto l = int(height()) - 2; l >= 0; --l) {
+            auto level_begin = levels_offsets[l];
+            auto level_size = levels_offsets[l + 1] - level_begin - 1;
+            auto pos = predict(i, key);
+            auto lo = PGM_SUB_EPS(pos, EpsilonRecursive + 1);
+            auto hi = PGM_ADD_EPS(pos, EpsilonRecursive, level_size);
+            auto window = hi > lo + 1 ? hi - lo - 1 : 0;
+            internal::record<Instrumentation>([&](auto &c) {
+                ++c.levels;
+                c.segments_scanned += window;
+            });
+            i = level_begin + lo + internal::count_less<true>(keys.data() + level_begin + lo + 1, window, key);
+        }
+        return i;
     }
 
+    /** Returns the position predicted for @p key by the i-th segment, clipped to the intercept of the next one. */
+    size_t predict(size_t i, const K &key) const {
+        size_t pos = segments[i](keys[i], key);
+        size_t bound = segments[i + 1].intercept;
+        internal::record<Instrumentation>([&](auto &c) { c.clipped += pos > bound; });
+        return std::min(pos, bound);
+    }
+
+public:
+
+    static constexpr size_t epsilon_value = Epsilon;
+
     /**
-     * Constructs a new disk-backed container on the sorted keys from the given input file.
-     *
-     * The @p in_filename must be a binary file containing a sorted sequence numbers of type @p K with the same
-     * endianness of the CPU.
-     *
-     * @param in_filename the name of the input file
-     * @param out_filename the name of the output file
+     * Constructs an empty index.
      */
-    MappedPGMIndex(const std::string &in_filename, const std::string &out_filename)
-        : base(),
-          data(),
-          file_bytes(),
-          header_bytes() {
-        struct stat fs;
-        stat(in_filename.c_str(), &fs);
-        auto in_bytes = fs.st_size;
-        if (in_bytes % sizeof(K) != 0)
-            throw std::runtime_error("Input file size must be a multiple of " + std::to_string(sizeof(K)) + " bytes.");
+    SoAPGMIndex() = default;
+
+    /**
+     * Constructs the index on the given sorted vector.
+     * @param data the vector of keys to be indexed, must be sorted
+     */
+    explicit SoAPGMIndex(const std::vector<K> &data) : SoAPGMIndex(data.begin(), data.end()) {}
 
-        auto in_data = map_file(in_filename, in_bytes);
-        this->n = in_bytes / sizeof(K);
-        this->template build(in_data, in_data + this->n, Epsilon, EpsilonRecursive,
-                             this->segments, this->levels_offsets);
-        serialize_and_map(in_data, in_data + this->n, out_filename);
-        unmap_file(in_data, in_bytes);
+    /**
+     * Constructs the index on the sorted keys in the range [first, last).
+     * @param first, last the range containing the sorted keys to be indexed
+     */
+    template<typename RandomIt>
+    SoAPGMIndex(RandomIt first, RandomIt last)
+        : n(std::distance(first, last)),
+          first_key(n ? *first : K(0)),
+          keys(),
+          segments(),
+          levels_offsets() {
+        std::vector<Segment> tmp;
+        PGMIndex<K, Epsilon, EpsilonRecursive, Floating, Intercept>::build(first, last, Epsilon, EpsilonRecursive,
+                                                                            tmp, levels_offsets);
+        keys.reserve(tmp.size());
+        segments.reserve(tmp.size());
+        for (auto &s : tmp) {
+            keys.push_back(s.key);
+            segments.push_back(s);
+        }
     }
 
     /**
-     * Loads a disk-backed container from the given file.
-     * @param in_filename the name of the input file
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for
+     * @return a struct with the approximate position and bounds of the range
      */
-    explicit MappedPGMIndex(const std::string &in_filename)
-        : base(),
-          data(),
-          file_bytes(),
-          header_bytes() {
-        auto in = std::fstream(in_filename, std::ios::in | std::ios::binary);
-        read_member(header_bytes, in);
-        read_member(this->n, in);
-        read_member(this->first_key, in);
-        read_container(this->levels_offsets, in);
-        read_container(this->segments, in);
-        file_bytes = header_bytes + this->n * sizeof(K);
-        data = map_file(in_filename, file_bytes);
+    ApproxPos search(const K &key) const {
+        auto k = std::max(first_key, key);
+        auto i = segment_for_key(k);
+        auto pos = predict(i, k);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.searches;
+            c.window += hi - lo;
+        });
+        return {pos, lo, hi};
     }
 
     /**
-     * Destructs the object and closes the file backing the container.
+     * Returns the number of segments in the last level of the index.
+     * @return the number of segments
      */
-    ~MappedPGMIndex() { unmap_file(data, file_bytes); }
+    size_t segments_count() const { return keys.empty() ? 0 : levels_offsets[1] - 1; }
 
     /**
-     * Checks if there is an element with key equivalent to @p key in the container.
-     * @param key the value of the element to search for
-     * @return @c true if there is such an element, otherwise @c false
+     * Returns the number of levels of the index.
+     * @return the number of levels of the index
      */
-    bool contains(const K &key) const {
-        auto range = this->search(key);
-        return std::binary_search(begin() + range.lo, begin() + range.hi, key);
-    }
+    size_t height() const { return levels_offsets.size() - 1; }
 
     /**
-     * Returns an iterator pointing to the first element that is not less than (i.e. greater or equal to) @p key.
-     * @param key value to compare the elements to
-     * @return iterator to the first element that is not less than @p key, or @ref end() if no such element is found
+     * Returns the size of the index in bytes.
+     * @return the size of the index in bytes
      */
-    auto lower_bound(const K &key) const {
-        auto range = this->search(key);
-        return std::lower_bound(begin() + range.lo, begin() + range.hi, key);
+    size_t size_in_bytes() const {
+        return keys.size() * sizeof(K) + segments.size() * sizeof(SegmentData)
+            + levels_offsets.size() * sizeof(size_t);
     }
+};
+
+/**
+ * A variant of @ref PGMIndex whose levels are laid out in cache-line-aligned blocks, like the nodes of a B-tree.
+ *
+ * The keys of the segments are stored apart from their slopes and intercepts (as in @ref SoAPGMIndex) in a single
+ * allocation aligned to a cache line. The levels are stored from the root downwards, so that the small upper levels
+ * are packed at the front of the allocation and stay hot in the L1 cache, and each level starts at a cache-line
+ * boundary and is padded with sentinel keys. The search in a level then reads a fixed number of whole cache lines
+ * starting from the line containing the left end of the window, which removes both the variable number of lines
+ * touched by unaligned windows and the branches on the window bounds.
+ *
+ * @tparam K the type of the indexed keys, whose size must divide the size of a cache line
+ * @tparam Epsilon controls the size of the returned search range
+ * @tparam EpsilonRecursive controls the size of the search range in the internal structure
+ * @tparam Floating the floating-point type to use for slopes
+ * @tparam Intercept the signed integer type to use for intercepts, which must be able to represent @c n
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex
+ */
+template<typename K, size_t Epsilon = 64, size_t EpsilonRecursive = 4, typename Floating = float,
+         typename Intercept = int32_t, typename Instrumentation = NoInstrumentation>
+class CacheAlignedPGMIndex {
+protected:
+    static_assert(Epsilon > 0 && EpsilonRecursive > 0);
+    static_assert(64 % sizeof(K) == 0, "The size of K must divide the size of a cache line");
+
+    using Segment = typename PGMIndex<K, Epsilon, EpsilonRecursive, Floating, Intercept>::Segment;
+
+    static constexpr size_t line_keys = 64 / sizeof(K); ///< The number of keys in a cache line.
+
+    /** The number of cache lines that contain any window of a level, when read from the start of its first line. */
+    static constexpr size_t window_lines = 1 + CEIL_INT_DIV(2 * EpsilonRecursive + 2, line_keys);
+
+    struct alignas(64) Line {
+        K keys[line_keys];
+    };
+
+    using SegmentData = internal::SegmentData<K, Floating, Intercept>;
+
+    size_t n;                           ///< The number of elements this index was built on.
+    K first_key;                        ///< The smallest element.
+    std::vector<Line> lines;            ///< The first key of each segment, root level first, each level line-aligned.
+    std::vector<SegmentData> segments;  ///< The slope and intercept of each segment, parallel to the keys in lines.
+    std::vector<size_t> levels_offsets; ///< The starting position of each level in the keys, from the bottom level.
+    std::vector<size_t> levels_sizes;   ///< The number of segments in each level, from the bottom level.
+
+    const K *keys() const { return lines.front().keys; }
 
     /**
-     * Returns an iterator pointing to the first element that is greater than @p key.
-     * @param key value to compare the elements to
-     * @return iterator to the first element that is greater than @p key, or @ref end() if no such element is found
+     * Returns the position of the segment responsible for a given key, that is, the rightmost segment having key <= the
+     * sought key.
+     * @param key the value of the element to search for
+     * @return the position in keys() of the segment responsible for the given key
      */
-    auto upper_bound(const K &key) const {
-        auto range = this->search(key);
-        auto it = std::upper_bound(begin() + range.lo, begin() + range.hi, key);
-        auto step = 1ull;
-        while (it + step < end() && *(it + step) == key)  // exponential search to skip duplicates
-            step *= 2;
-        return std::upper_bound(it + (step / 2), std::min(it + step, end()), key);
+    size_t segment_for_key(const K &key) const {
+        auto i = levels_offsets.back();
+        for (auto l = int(height()) - 2; l >= 0; --l) {
+            auto pos = predict(i, key);
+            auto line_begin = PGM_SUB_EPS(pos, EpsilonRecursive + 1) & ~(line_keys - 1);
+            auto block = keys() + levels_offsets[l] + line_begin;
+            for (size_t j = 0; j < window_lines; ++j)
+                __builtin_prefetch(block + j * line_keys, 0, 3);
+
+            // Keys before the window are <= key, so they are counted too and offset line_begin to the right position
+            auto count = internal::count_less<true>(block, window_lines * line_keys, key);
+            i = levels_offsets[l] + std::min(line_begin + count, levels_sizes[l]) - 1;
+            internal::record<Instrumentation>([&](auto &c) {
+                ++c.levels;
+                c.segments_scanned += window_lines * line_keys;
+            });
+        }
+        return i;
+    }
+
+    /** Returns the position predicted for @p key by the i-th segment, clipped to the intercept of the next one. */
+    size_t predict(size_t i, const K &key) const {
+        size_t pos = segments[i](keys()[i], key);
+        size_t bound = segments[i + 1].intercept;
+        internal::record<Instrumentation>([&](auto &c) { c.clipped += pos > bound; });
+        return std::min(pos, bound);
     }
 
+public:
+
+    static constexpr size_t epsilon_value = Epsilon;
+
     /**
-     * Returns the number of elements with key equal to the specified argument.
-     * @param key value of the elements to count
-     * @return the number of elements with key equal to @p key
+     * Constructs an empty index.
      */
-    size_t count(const K &key) const {
-        auto lb = lower_bound(key);
-        if (lb == end() || *lb != key)
-            return 0;
-        return std::distance(lb, upper_bound(key));
+    CacheAlignedPGMIndex() = default;
+
+    /**
+     * Constructs the index on the given sorted vector.
+     * @param data the vector of keys to be indexed, must be sorted
+     */
+    explicit CacheAlignedPGMIndex(const std::vector<K> &data) : CacheAlignedPGMIndex(data.begin(), data.end()) {}
+
+    /**
+     * Constructs the index on the sorted keys in the range [first, last).
+     * @param first, last the range containing the sorted keys to be indexed
+     */
+    template<typename RandomIt>
+    CacheAlignedPGMIndex(RandomIt first, RandomIt last)
+        : n(std::distance(first, last)),
+          first_key(n ? *first : K(0)),
+          lines(),
+          segments(),
+          levels_offsets(),
+          levels_sizes() {
+        if (n == 0)
+            return;
+
+        std::vector<Segment> tmp;
+        std::vector<size_t> tmp_offsets;
+        PGMIndex<K, Epsilon, EpsilonRecursive, Floating, Intercept>::build(first, last, Epsilon, EpsilonRecursive,
+                                                                            tmp, tmp_offsets);
+
+        // Each level holds its segments, the sentinel, and enough padding for a read of window_lines from any window
+        auto levels = tmp_offsets.size() - 1;
+        size_t total_keys = 0;
+        levels_offsets.resize(levels);
+        levels_sizes.resize(levels);
+        for (auto l = int(levels) - 1; l >= 0; --l) {
+            levels_offsets[l] = total_keys;
+            levels_sizes[l] = tmp_offsets[l + 1] - tmp_offsets[l] - 1;
+            total_keys += CEIL_INT_DIV(levels_sizes[l] + 1, line_keys) * line_keys + window_lines * line_keys;
+        }
+
+        lines.resize(total_keys / line_keys);
+        segments.resize(total_keys);
+        auto keys = lines.front().keys;
+        std::fill(keys, keys + total_keys, std::numeric_limits<K>::max());
+        for (size_t l = 0; l < levels; ++l) {
+            for (size_t j = 0; j <= levels_sizes[l]; ++j) {
+                keys[levels_offsets[l] + j] = tmp[tmp_offsets[l] + j].key;
+                segments[levels_offsets[l] + j] = tmp[tmp_offsets[l] + j];
+            }
+        }
     }
 
     /**
-     * Returns the number of elements in the container.
-     * @return the number of elements in the container
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for
+     * @return a struct with the approximate position and bounds of the range
      */
-    size_t size() const { return this->n; }
+    ApproxPos search(const K &key) const {
+        auto k = std::max(first_key, key);
+        auto i = segment_for_key(k);
+        auto pos = predict(i, k);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.searches;
+            c.window += hi - lo;
+        });
+        return {pos, lo, hi};
+    }
 
     /**
-     * Returns the size in bytes of the file backing the container.
-     * @return the size in bytes of the file backing the container
+     * Returns the number of segments in the last level of the index.
+     * @return the number of segments
      */
-    size_t file_size_in_bytes() const { return file_bytes; }
+    size_t segments_count() const { return levels_sizes.empty() ? 0 : levels_sizes.front(); }
 
     /**
-     * Returns an iterator to the first element of the container.
-     * @return an iterator to the first element of the container
+     * Returns the number of levels of the index.
+     * @return the number of levels of the index
      */
-    auto begin() const { return (K *) ((char *) data + header_bytes); }
+    size_t height() const { return levels_offsets.size(); }
 
     /**
-     * Returns an iterator to the element following the last element of the container.
-     * @return an iterator to the element following the last element of the container
+     * Returns the size of the index in bytes.
+     * @return the size of the index in bytes
      */
-    auto end() const { return begin() + size(); }
+    size_t size_in_bytes() const {
+        return lines.size() * sizeof(Line) + segments.size() * sizeof(SegmentData)
+            + (levels_offsets.size() + levels_sizes.size()) * sizeof(size_t);
+    }
+};
 
-private:
+/**
+ * A variant of @ref PGMIndex that is built incrementally on keys appended in strictly increasing order, such as the
+ * timestamps of a stream of events.
+ *
+ * Each level keeps the segments it has completed and an open model for its last segment. An appended key is added to
+ * the open model of the last level. When the model cannot include the key, its segment is completed, and its first
+ * key is appended to the level above in the same way. So an append takes amortized constant time, and after each
+ * append the index covers all the keys appended so far.
+ *
+ * @tparam K the type of the indexed keys
+ * @tparam Epsilon controls the size of the returned search range
+ * @tparam EpsilonRecursive controls the size of the search range in the internal structure
+ * @tparam Floating the floating-point type to use for slopes
+ * @tparam Intercept the signed integer type to use for intercepts, which must be able to represent the number of
+ * keys appended, e.g. int64_t for streams of more than 2^31 keys
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex. Every level is
+ * searched, including the top one, which may have more than one segment
+ */
+template<typename K, size_t Epsilon = 64, size_t EpsilonRecursive = 4, typename Floating = float,
+         typename Intercept = int32_t, typename Instrumentation = NoInstrumentation>
+class AppendablePGMIndex {
+protected:
+    static_assert(Epsilon > 0);
 
-    template<class RandomIt>
-    void serialize_and_map(RandomIt first, RandomIt last, const std::string &out_filename) {
-        auto out = std::fstream(out_filename, std::ios::out | std::ios::binary);
-        header_bytes += write_member(header_bytes, out);
-        header_bytes += write_member(this->n, out);
-        header_bytes += write_member(this->first_key, out);
-        header_bytes += write_container(this->levels_offsets, out);
-        header_bytes += write_container(this->segments, out);
-        for (auto it = first; it != last; ++it)
-            write_member(*it, out);
-        file_bytes = header_bytes + this->n * sizeof(K);
-        out.seekp(0);
-        write_member(header_bytes, out);
-        data = map_file(out_filename, file_bytes);
+    using Segment = typename PGMIndex<K, Epsilon, EpsilonRecursive, Floating, Intercept>::Segment;
+    using Model = internal::OptimalPiecewiseLinearModel<K, size_t>;
+
+    /** A level, whose open segment is computed from the model only when a search predicts with it. */
+    struct Level {
+        Model model;                   ///< The model of the last segment of the level, which is still open.
+        std::vector<Segment> segments; ///< The completed segments of the level.
+        K tail_key;                    ///< The first key of the open segment.
+        size_t tail_first;             ///< The position of the first key of the open segment.
+        size_t points;                 ///< The number of points added to the level.
+
+        explicit Level(size_t epsilon) : model(epsilon), segments(), tail_key(), tail_first(), points() {}
+    };
+
+    size_t n;                  ///< The number of elements in the index.
+    K first_key;               ///< The smallest element.
+    K last_key;                ///< The largest element.
+    std::vector<Level> levels; ///< The levels of the index, from the bottom one.
+
+    void add_point(size_t l, const K &x) {
+        if (l == levels.size())
+            levels.emplace_back(l == 0 ? Epsilon : EpsilonRecursive);
+
+        auto &level = levels[l];
+        auto completed = !level.model.add_point(x, level.points);
+        if (completed) {
+            level.segments.emplace_back(level.model.get_segment());
+            level.model.add_point(x, level.points);
+        }
+        if (completed || level.points == 0) {
+            level.tail_key = x;
+            level.tail_first = level.points;
+        }
+        ++level.points;
+
+        if (completed && EpsilonRecursive != 0)
+            add_point(l + 1, levels[l].segments.back().key);
     }
 
-    static K *map_file(const std::string &in_filename, size_t file_bytes) {
-        auto fd = open(in_filename.c_str(), O_RDONLY);
-        if (fd == -1)
-            throw std::runtime_error("Open file error" + std::string(strerror(errno)));
+    /** Returns the position predicted for @p key by the i-th segment of level @p l, the last one being the tail. */
+    size_t predict(size_t l, size_t i, const K &key) const {
+        auto &level = levels[l];
+        auto m = level.segments.size();
+        size_t bound = i + 1 < m ? level.segments[i + 1].intercept : i + 1 == m ? level.tail_first : level.points;
+        auto pos = i < m ? level.segments[i](key) : Segment(level.model.get_segment())(key);
+        internal::record<Instrumentation>([&](auto &c) { c.clipped += pos > bound; });
+        return std::min(pos, bound);
+    }
 
-        auto data = (K *) mmap(nullptr, file_bytes, PROT_READ, MAP_SHARED, fd, 0);
-        if (data == MAP_FAILED)
-            throw std::runtime_error("mmap error" + std::string(strerror(errno)));
-        return data;
+    /** Returns the index in level @p l of the rightmost segment having key <= @p key among those in [lo, hi). */
+    size_t segment_in_range(size_t l, size_t lo, size_t hi, const K &key) const {
+        auto &level = levels[l];
+        auto tail = key >= level.tail_key;
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.levels;
+            c.segments_scanned += 1 + (tail ? 0 : internal::binary_search_probes(hi - lo));
+        });
+        if (tail)
+            return level.segments.size();
+        auto first = level.segments.begin();
+        return std::distance(first, std::upper_bound(first + lo, first + hi, key)) - 1;
     }
 
-    static void unmap_file(K *data, size_t file_bytes) {
-        if (data && munmap(data, file_bytes))
-            std::cerr << "munmap error " << std::string(strerror(errno));
+public:
+
+    static constexpr size_t epsilon_value = Epsilon;
+
+    /**
+     * Constructs an empty index.
+     */
+    AppendablePGMIndex() : n(0), first_key(), last_key(), levels() {}
+
+    /**
+     * Constructs the index on the strictly increasing keys in the range [first, last).
+     * @param first, last the range containing the keys to be indexed
+     */
+    template<typename InputIt>
+    AppendablePGMIndex(InputIt first, InputIt last) : AppendablePGMIndex() {
+        append(first, last);
+    }
+
+    /**
+     * Appends a key to the index.
+     * @param key the key to append, must be greater than the keys already in the index
+     */
+    void push_back(const K &key) {
+        if (n > 0 && !(last_key < key))
+            throw std::invalid_argument("Keys must be appended in strictly increasing order");
+        if (n == 0)
+            first_key = key;
+        last_key = key;
+        add_point(0, key);
+        ++n;
+    }
+
+    /**
+     * Appends the keys in the range [first, last) to the index.
+     * @param first, last the range containing the keys to append, which must be greater than the keys in the index
+     */
+    template<typename InputIt>
+    void append(InputIt first, InputIt last) {
+        for (; first != last; ++first)
+            push_back(*first);
+    }
+
+    /**
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for
+     * @return a struct with the approximate position and bounds of the range
+     */
+    ApproxPos search(const K &key) const {
+        if (n == 0)
+            return {0, 0, 0};
+
+        auto k = std::max(first_key, key);
+        auto l = levels.size() - 1;
+        auto i = segment_in_range(l, 0, levels[l].segments.size(), k);
+        for (; l > 0; --l) {
+            auto pos = predict(l, i, k);
+            auto lo = PGM_SUB_EPS(pos, EpsilonRecursive + 1);
+            auto hi = PGM_ADD_EPS(pos, EpsilonRecursive, levels[l - 1].segments.size());
+            i = segment_in_range(l - 1, lo, hi, k);
+        }
+
+        auto pos = predict(0, i, k);
+        auto lo = PGM_SUB_EPS(pos, Epsilon);
+        auto hi = PGM_ADD_EPS(pos, Epsilon, n);
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.searches;
+            c.window += hi - lo;
+        });
+        return {pos, lo, hi};
+    }
+
+    /**
+     * Returns the number of elements in the index.
+     * @return the number of elements in the index
+     */
+    size_t size() const { return n; }
+
+    /**
+     * Returns the number of segments in the last level of the index, including the open one.
+     * @return the number of segments
+     */
+    size_t segments_count() const { return levels.empty() ? 0 : levels.front().segments.size() + 1; }
+
+    /**
+     * Returns the number of levels of the index.
+     * @return the number of levels of the index
+     */
+    size_t height() const { return levels.size(); }
+
+    /**
+     * Returns the size of the index in bytes, excluding the buffers of the open models.
+     * @return the size of the index in bytes
+     */
+    size_t size_in_bytes() const {
+        size_t bytes = 0;
+        for (auto &level : levels)
+            bytes += (level.segments.size() + 1) * sizeof(Segment);
+        return bytes;
+    }
+};
+
+/**
+ * A variant of @ref PGMIndex whose last level is made of polynomial segments of degree up to @p Degree, rather than
+ * linear ones, which are indexed by a @ref PGMIndex.
+ *
+ * On keys whose distribution has a curved cumulative distribution function, such as log-normal keys, a polynomial
+ * follows the curve for a longer range than a line, so the index needs fewer segments and possibly fewer levels.
+ * Each segment stores the position of its first key and @p Degree @c float coefficients, so it takes 4 * (Degree - 1)
+ * bytes more than a segment of @ref PGMIndex, and the construction takes O(n log(n)) time. The polynomials pay off
+ * when they span a visible part of the curve, e.g. for larger epsilons, whereas for small ones the segments are short
+ * and nearly linear. At most 2^32 - 1 keys can be indexed, larger inputs throw @c std::overflow_error.
+ *
+ * The search range is two positions wider than that of @ref PGMIndex, to absorb the rounding of the polynomials.
+ * Keys greater than the largest indexed key are mapped directly to the range [n, n).
+ *
+ * @tparam K the type of the indexed keys
+ * @tparam Degree the maximum degree of the polynomials, from 1 to 3
+ * @tparam Epsilon controls the size of the returned search range
+ * @tparam EpsilonRecursive controls the size of the search range in the internal structure
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex
+ */
+template<typename K, size_t Degree = 2, size_t Epsilon = 64, size_t EpsilonRecursive = 4,
+         typename Instrumentation = NoInstrumentation>
+class PolynomialPGMIndex {
+protected:
+    static_assert(Epsilon > 0);
+
+    using Segment = internal::PolynomialSegment<K, Degree>;
+    using TopIndex = PGMIndex<K, (EpsilonRecursive > 0 ? EpsilonRecursive : 1), EpsilonRecursive, float, int32_t,
+                              OptimalSegmentation, internal::NestedInstrumentation<Instrumentation>>;
+
+    size_t n;                      ///< The number of elements this index was built on.
+    K first_key;                   ///< The smallest element.
+    K last_key;                    ///< The largest element.
+    std::vector<Segment> segments; ///< The segments of the last level, followed by a sentinel at position n.
+    TopIndex top;                  ///< The index on the first keys of the segments, if EpsilonRecursive != 0.
+
+    /** Returns an iterator to the rightmost segment having first key <= @p key. */
+    auto segment_for_key(const K &key) const {
+        auto first = segments.begin();
+        auto last = first + segments_count();
+        if constexpr (EpsilonRecursive != 0) {
+            auto range = top.search(key);
+            internal::record_nested<Instrumentation>();
+            last = first + range.hi;
+            first += range.lo;
+        }
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.levels;
+            c.segments_scanned += internal::binary_search_probes(std::distance(first, last));
+        });
+        auto cmp = [](const K &k, const Segment &s) { return k < s.first_x; };
+        return std::prev(std::upper_bound(first, last, key, cmp));
+    }
+
+public:
+
+    static constexpr size_t epsilon_value = Epsilon;
+
+    /**
+     * Constructs an empty index.
+     */
+    PolynomialPGMIndex() = default;
+
+    /**
+     * Constructs the index on the given sorted vector.
+     * @param data the vector of keys to be indexed, must be sorted
+     */
+    explicit PolynomialPGMIndex(const std::vector<K> &data) : PolynomialPGMIndex(data.begin(), data.end()) {}
+
+    /**
+     * Constructs the index on the sorted keys in the range [first, last).
+     * @param first, last the range containing the sorted keys to be indexed
+     */
+    template<typename RandomIt>
+    PolynomialPGMIndex(RandomIt first, RandomIt last)
+        : n(std::distance(first, last)),
+          first_key(n ? *first : K(0)),
+          last_key(n ? *std::prev(last) : K(0)),
+          segments(),
+          top() {
+        if (n == 0)
+            return;
+        if (n > std::numeric_limits<uint32_t>::max())
+            throw std::overflow_error("PolynomialPGMIndex cannot index more than 2^32 - 1 keys");
+
+        auto in_fun = [&](auto i) {
+            auto x = first[i];
+            // The same adjustment for duplicate keys as in PGMIndex
+            auto flag = i > 0 && i + 1u < n && x == first[i - 1] && x != first[i + 1] && x + 1 != first[i + 1];
+            return std::pair<K, size_t>(x + flag, i);
+        };
+        auto out_fun = [&](const Segment &s) { segments.push_back(s); };
+        internal::make_polynomial_segmentation<Degree>(n, Epsilon, in_fun, out_fun);
+
+        Segment sentinel{};
+        sentinel.first = uint32_t(n);
+        segments.push_back(sentinel);
+
+        if constexpr (EpsilonRecursive != 0) {
+            auto key_fn = [](const Segment &s) { return s.first_x; };
+            using key_iterator = ProjectionIterator<typename std::vector<Segment>::const_iterator, decltype(key_fn)>;
+            top = TopIndex(key_iterator(segments.cbegin(), key_fn), key_iterator(segments.cend() - 1, key_fn));
+        }
+    }
+
+    /**
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for
+     * @return a struct with the approximate position and bounds of the range
+     */
+    ApproxPos search(const K &key) const {
+        if (n == 0 || key > last_key) {
+            internal::record<Instrumentation>([](auto &c) { ++c.searches; });
+            return {n, n, n}; // The polynomial of the last segment is not bounded after the last key
+        }
+
+        auto k = std::max(first_key, key);
+        auto it = segment_for_key(k);
+        size_t bound = std::next(it)->first;
+        auto pos = it->position(k, bound);
+        auto lo = PGM_SUB_EPS(pos, Epsilon + 1);
+        auto hi = PGM_ADD_EPS(pos, Epsilon + 1, n);
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.searches;
+            c.window += hi - lo;
+            c.clipped += (*it)(k) > bound;
+        });
+        return {pos, lo, hi};
+    }
+
+    /**
+     * Returns the number of segments in the last level of the index.
+     * @return the number of segments
+     */
+    size_t segments_count() const { return segments.empty() ? 0 : segments.size() - 1; }
+
+    /**
+     * Returns the number of levels of the index.
+     * @return the number of levels of the index
+     */
+    size_t height() const { return segments.empty() ? 0 : 1 + (EpsilonRecursive != 0 ? top.height() : 0); }
+
+    /**
+     * Returns the size of the index in bytes.
+     * @return the size of the index in bytes
+     */
+    size_t size_in_bytes() const { return segments.size() * sizeof(Segment) + top.size_in_bytes(); }
+};
+
+/**
+ * A variant of @ref PGMIndex whose epsilon varies across the key space according to a sample of the query workload.
+ *
+ * The keys are split into regions spanning the same number of the segments of a @ref PGMIndex with a reference
+ * epsilon, and each region is segmented with its own epsilon, chosen among the powers of two times the reference one.
+ * Frequently queried regions get a smaller epsilon, hence a narrower search range, and the other ones a larger
+ * epsilon, so that the last level takes no more space than that of the @ref PGMIndex. This space includes a segment
+ * at each boundary between regions with different epsilons, and the epsilon of each run of regions with the same one.
+ * The choice greedily minimises the expected cost of the last-mile search, that is, the sum over the sampled queries of
+ * the logarithm of the size of their search range.
+ *
+ * The sample has the format of the workloads read by the benchmark, that is, any sequence of keys. Searches return the
+ * range given by the epsilon of the run of the segment responsible for the key.
+ *
+ * @tparam K the type of the indexed keys
+ * @tparam EpsilonRecursive controls the size of the search range in the internal structure
+ * @tparam Floating the floating-point type to use for slopes
+ * @tparam Intercept the signed integer type to use for intercepts, which must be able to represent @c n
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex
+ */
+template<typename K, size_t EpsilonRecursive = 4, typename Floating = float, typename Intercept = int32_t,
+         typename Instrumentation = NoInstrumentation>
+class WorkloadAwarePGMIndex {
+protected:
+    using Segment = typename PGMIndex<K, 1, 1, Floating, Intercept>::Segment;
+    using TopIndex = PGMIndex<K, (EpsilonRecursive > 0 ? EpsilonRecursive : 1), EpsilonRecursive, float, int32_t,
+                              OptimalSegmentation, internal::NestedInstrumentation<Instrumentation>>;
+
+    static constexpr size_t max_epsilon_shift = 4;        ///< The epsilons range from the reference one / 16 to * 16.
+    static constexpr size_t min_segments_per_region = 16; ///< The minimum size of a region, in reference segments.
+
+    /** A maximal run of segments with the same epsilon, in 32-bit fields that the constructor checks for overflow. */
+    struct Run {
+        uint32_t first;   ///< The position of the first segment of the run.
+        uint32_t epsilon; ///< The epsilon of the segments of the run.
+    };
+
+    size_t n;                       ///< The number of elements this index was built on.
+    K first_key;                    ///< The smallest element.
+    K last_key;                     ///< The largest element, excluding the sentinel max().
+    size_t epsilon;                 ///< The reference epsilon, which determines the space budget.
+    std::vector<Segment> segments;  ///< The segments of the last level, followed by a sentinel at position n.
+    std::vector<Run> runs;          ///< The runs of segments with the same epsilon, or none if it is the reference.
+    TopIndex top;                   ///< The index on the keys of the segments, if EpsilonRecursive != 0.
+
+    /** Returns an iterator to the run of the segment at position @p i, where @p runs must not be empty. */
+    auto run_for_segment(size_t i) const {
+        return std::prev(std::upper_bound(runs.begin(), runs.end(), i, [](size_t i, const Run &r) {
+            return i < r.first;
+        }));
+    }
+
+    /** Returns the position of the rightmost segment having key <= @p key. */
+    size_t segment_for_key(const K &key) const {
+        auto first = segments.begin();
+        auto last = first + segments_count();
+        if constexpr (EpsilonRecursive != 0) {
+            auto range = top.search(std::min(key, last_key)); // Keeps max(), the sentinel of top, out of it
+            internal::record_nested<Instrumentation>();
+            last = first + range.hi;
+            first += range.lo;
+        }
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.levels;
+            c.segments_scanned += internal::binary_search_probes(std::distance(first, last));
+        });
+        return std::distance(segments.begin(), std::prev(std::upper_bound(first, last, key)));
+    }
+
+    /**
+     * Returns the epsilon of each region, given the number of segments of each region with each candidate epsilon
+     * and the number of sampled queries that fall in each region.
+     *
+     * The space of a choice is that of its segments, of a segment at each boundary between regions with different
+     * epsilons, and of the runs of regions with the same epsilon, which must not exceed the space of the segments
+     * with the reference epsilon alone.
+     */
+    static std::vector<size_t> choose_epsilons(const std::vector<size_t> &candidates,
+                                               const std::vector<std::vector<size_t>> &counts,
+                                               const std::vector<size_t> &weights, size_t reference) {
+        auto regions = weights.size();
+        auto log_range = [&](size_t c) { return std::log2(2.0 * candidates[c] + 2); };
+
+        // Start from the largest epsilon everywhere, and shrink it where it buys the most per extra byte
+        std::vector<size_t> choice(regions, 0);
+        size_t segments_count = 0;
+        size_t boundaries = 0;
+        size_t budget = 0;
+        for (size_t r = 0; r < regions; ++r) {
+            budget += counts[r][reference] * sizeof(Segment);
+            segments_count += counts[r][0];
+        }
+        auto bytes = [&](size_t segments_count, size_t boundaries) {
+            return (segments_count + boundaries) * sizeof(Segment) + (boundaries + 1) * sizeof(Run);
+        };
+        auto boundaries_around = [&](size_t r, size_t c) {
+            return size_t(r > 0 && choice[r - 1] != c) + size_t(r + 1 < regions && choice[r + 1] != c);
+        };
+        auto step_bytes = [&](size_t r) {
+            auto c = choice[r];
+            auto new_boundaries = boundaries - boundaries_around(r, c) + boundaries_around(r, c + 1);
+            auto new_segments_count = segments_count - counts[r][c] + counts[r][c + 1];
+            return std::make_pair(new_segments_count, new_boundaries);
+        };
+
+        using step = std::pair<double, size_t>; // (benefit per extra byte, region)
+        std::priority_queue<step> steps;
+        auto push_step = [&](size_t r) {
+            auto c = choice[r];
+            if (c + 1 == candidates.size() || weights[r] == 0)
+                return;
+            auto benefit = weights[r] * (log_range(c) - log_range(c + 1));
+            auto[new_segments_count, new_boundaries] = step_bytes(r);
+            auto before = bytes(segments_count, boundaries);
+            auto after = bytes(new_segments_count, new_boundaries);
+            steps.emplace(after > before ? benefit / (after - before) : std::numeric_limits<double>::infinity(), r);
+        };
+        for (size_t r = 0; r < regions; ++r)
+            push_step(r);
+
+        while (!steps.empty()) {
+            auto r = steps.top().second;
+            steps.pop();
+            auto[new_segments_count, new_boundaries] = step_bytes(r);
+            if (bytes(new_segments_count, new_boundaries) > budget)
+                continue;
+            segments_count = new_segments_count;
+            boundaries = new_boundaries;
+            ++choice[r];
+            push_step(r);
+        }
+
+        // The greedy choice is not optimal, so fall back to the reference epsilon if that is cheaper
+        double cost = 0;
+        double reference_cost = 0;
+        for (size_t r = 0; r < regions; ++r) {
+            cost += weights[r] * log_range(choice[r]);
+            reference_cost += weights[r] * log_range(reference);
+        }
+        if (reference_cost <= cost || bytes(segments_count, boundaries) > budget)
+            std::fill(choice.begin(), choice.end(), reference);
+
+        std::vector<size_t> result(regions);
+        for (size_t r = 0; r < regions; ++r)
+            result[r] = candidates[choice[r]];
+        return result;
+    }
+
+    /**
+     * Splits the keys in [first, first + last_n) into regions and segments each one with the epsilon chosen for it
+     * from the sample of queries in [queries_first, queries_last), filling @ref segments and @ref runs.
+     */
+    template<typename RandomIt, typename QueryIt>
+    void segment_regions(RandomIt first, size_t last_n, QueryIt queries_first, QueryIt queries_last, size_t regions) {
+        auto in_fun = [&](auto i) {
+            auto x = first[i];
+            // The same adjustment for duplicate keys as in PGMIndex
+            auto flag = i > 0 && i + 1u < n && x == first[i - 1] && x != first[i + 1] && x + 1 != first[i + 1];
+            return std::pair<K, size_t>(x + flag, i);
+        };
+
+        // Split the keys into regions at the boundaries of the segments given by the reference epsilon, so that
+        // segmenting each region with the reference epsilon gives the same segments as segmenting all the keys
+        SegmentationWorkspace<K> workspace;
+        std::vector<size_t> starts;
+        auto start_fun = [&](const auto &, size_t i) { starts.push_back(i); };
+        internal::make_segmentation_range(0, last_n, epsilon, in_fun, start_fun, workspace.hull(0));
+        regions = std::clamp<size_t>(std::min(regions, starts.size() / min_segments_per_region), 1, starts.size());
+        std::vector<size_t> bounds(regions + 1, last_n);
+        for (size_t r = 0; r < regions; ++r)
+            bounds[r] = starts[r * starts.size() / regions];
+
+        std::vector<size_t> weights(regions, 0);
+        for (auto it = queries_first; it != queries_last; ++it) {
+            auto b = std::upper_bound(bounds.begin() + 1, bounds.end() - 1, *it,
+                                      [&](const K &q, size_t i) { return q < first[i]; });
+            ++weights[std::distance(bounds.begin() + 1, b)];
+        }
+
+        std::vector<size_t> candidates;
+        for (auto shift = max_epsilon_shift; shift > 0; --shift)
+            candidates.push_back(epsilon << shift);
+        size_t reference = candidates.size();
+        for (size_t shift = 0; shift <= max_epsilon_shift && epsilon >> shift > 0; ++shift)
+            candidates.push_back(epsilon >> shift);
+
+        std::vector<std::vector<size_t>> counts(regions, std::vector<size_t>(candidates.size()));
+        for (size_t c = 0; c < candidates.size(); ++c) {
+            for (size_t r = 0; r < regions; ++r) {
+                auto count_fun = [&](const auto &, size_t) { ++counts[r][c]; };
+                internal::make_segmentation_range(bounds[r], bounds[r + 1], candidates[c], in_fun, count_fun,
+                                                  workspace.hull(0));
+            }
+        }
+
+        auto chosen = choose_epsilons(candidates, counts, weights, reference);
+        auto uniform = std::all_of(chosen.begin(), chosen.end(), [&](size_t e) { return e == epsilon; });
+        for (size_t r = 0; r < regions; ++r) {
+            if (!uniform && (r == 0 || chosen[r] != chosen[r - 1])) {
+                auto run_max = std::numeric_limits<uint32_t>::max();
+                if (segments.size() > run_max || chosen[r] > run_max)
+                    throw std::overflow_error("The first segment and the epsilon of a run must fit in 32 bits");
+                runs.push_back({uint32_t(segments.size()), uint32_t(chosen[r])});
+            }
+
+            auto out_fun = [&](const auto &cs, size_t) { segments.emplace_back(cs); };
+            internal::make_segmentation_range(bounds[r], bounds[r + 1], chosen[r], in_fun, out_fun,
+                                              workspace.hull(0));
+
+            if (r + 1 < regions && chosen[r] != chosen[r + 1]) {
+                // The intercept of the next segment is within its own epsilon from the position of its key, so it
+                // cannot bound the positions predicted by the segments of this region. Here we add a segment that
+                // bounds them, and predicts the exact position of the keys between this region and the next one
+                auto b = bounds[r + 1];
+                if constexpr (std::is_floating_point_v<K>)
+                    segments.emplace_back(std::nextafter(first[b - 1], std::numeric_limits<K>::infinity()), 0, b);
+                else
+                    segments.emplace_back(K(first[b - 1] + 1), 0, b);
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Constructs an empty index.
+     */
+    WorkloadAwarePGMIndex() = default;
+
+    /**
+     * Constructs the index on the given sorted vector.
+     * @param data the vector of keys to be indexed, must be sorted
+     * @param queries a sample of the keys that will be searched, in any order
+     * @param epsilon the reference epsilon, which determines the space budget, must be > 0
+     * @param regions the maximum number of regions in which the key space is split
+     */
+    WorkloadAwarePGMIndex(const std::vector<K> &data, const std::vector<K> &queries, size_t epsilon,
+                          size_t regions = 256)
+        : WorkloadAwarePGMIndex(data.begin(), data.end(), queries.begin(), queries.end(), epsilon, regions) {}
+
+    /**
+     * Constructs the index on the sorted keys in the range [first, last).
+     * @param first, last the range containing the sorted keys to be indexed
+     * @param queries_first, queries_last the range containing a sample of the keys that will be searched
+     * @param epsilon the reference epsilon, which determines the space budget, must be > 0
+     * @param regions the maximum number of regions in which the key space is split
+     */
+    template<typename RandomIt, typename QueryIt>
+    WorkloadAwarePGMIndex(RandomIt first, RandomIt last, QueryIt queries_first, QueryIt queries_last,
+                          size_t epsilon, size_t regions = 256)
+        : n(std::distance(first, last)),
+          first_key(n ? *first : K(0)),
+          last_key(std::numeric_limits<K>::lowest()),
+          epsilon(epsilon),
+          segments(),
+          runs(),
+          top() {
+        if (epsilon == 0)
+            throw std::invalid_argument("epsilon must be > 0");
+        if (n == 0)
+            return;
+
+        // max() is the sentinel value, as in PGMIndex
+        auto last_n = n - (first[n - 1] == std::numeric_limits<K>::max());
+        if (last_n > 0) {
+            segment_regions(first, last_n, queries_first, queries_last, regions);
+            last_key = first[last_n - 1];
+        } else {
+            segments.emplace_back(std::numeric_limits<K>::lowest(), 0, 0); // Maps any key to the position of max()
+        }
+
+        if (segments.back().slope == 0 && last_n > 1 && last_key < std::numeric_limits<K>::max()) {
+            // Here we need to ensure that keys > the last key are approximated to a position == last_n
+            segments.emplace_back(last_key + 1, 0, last_n);
+        }
+        segments.emplace_back(last_n);
+
+        if constexpr (EpsilonRecursive != 0) {
+            auto key_fn = [](const Segment &s) { return s.key; };
+            using key_iterator = ProjectionIterator<typename std::vector<Segment>::const_iterator, decltype(key_fn)>;
+            top = TopIndex(key_iterator(segments.cbegin(), key_fn), key_iterator(segments.cend() - 1, key_fn));
+        }
+    }
+
+    /**
+     * Returns the approximate position and the range where @p key can be found.
+     * @param key the value of the element to search for
+     * @return a struct with the approximate position and bounds of the range
+     */
+    ApproxPos search(const K &key) const {
+        if (n == 0)
+            return {0, 0, 0};
+        auto k = std::max(first_key, key);
+        auto i = segment_for_key(k);
+        auto e = epsilon;
+        auto bound = size_t(segments[i + 1].intercept);
+        if (!runs.empty()) {
+            // The next segment bounds the prediction only if it has the same epsilon, see the constructor
+            auto run = run_for_segment(i);
+            e = run->epsilon;
+            if (std::next(run) != runs.end() && i + 1 == std::next(run)->first)
+                bound = n;
+        }
+        // The prediction is clamped to the bound before its conversion to an integer, which would overflow for the
+        // keys far past the last segment, up to max()
+        auto &s = segments[i];
+        auto delta = s.slope * (k - s.key);
+        auto room = decltype(delta)(int64_t(bound) - s.intercept);
+        internal::record<Instrumentation>([&](auto &c) { c.clipped += delta > room; });
+        auto pos = size_t(int64_t(std::min(delta, room)) + s.intercept);
+        auto lo = PGM_SUB_EPS(pos, e);
+        auto hi = PGM_ADD_EPS(pos, e, n);
+        internal::record<Instrumentation>([&](auto &c) {
+            ++c.searches;
+            c.window += hi - lo;
+        });
+        return {pos, lo, hi};
+    }
+
+    /**
+     * Returns the number of elements the index was built on.
+     * @return the number of elements the index was built on
+     */
+    size_t size() const { return n; }
+
+    /**
+     * Returns the reference epsilon, which determines the space budget.
+     * @return the reference epsilon
+     */
+    size_t epsilon_value() const { return epsilon; }
+
+    /**
+     * Returns the epsilon of the segment responsible for @p key.
+     * @param key the value of an element
+     * @return the epsilon used to search for @p key
+     */
+    size_t epsilon_for(const K &key) const {
+        if (n == 0)
+            return 0;
+        return runs.empty() ? epsilon : run_for_segment(segment_for_key(std::max(first_key, key)))->epsilon;
+    }
+
+    /**
+     * Returns the number of segments in the last level of the index.
+     * @return the number of segments
+     */
+    size_t segments_count() const { return segments.empty() ? 0 : segments.size() - 1; }
+
+    /**
+     * Returns the number of levels of the index.
+     * @return the number of levels of the index
+     */
+    size_t height() const { return segments.empty() ? 0 : 1 + (EpsilonRecursive != 0 ? top.height() : 0); }
+
+    /**
+     * Returns the size of the index in bytes.
+     * @return the size of the index in bytes
+     */
+    size_t size_in_bytes() const {
+        return segments.size() * sizeof(Segment) + runs.size() * sizeof(Run) + top.size_in_bytes();
+    }
+};
+
+/**
+ * A multiset container that stores each distinct key once, together with the boundaries of its run of duplicates,
+ * and uses a @ref PGMIndex on the distinct keys for fast search operations.
+ *
+ * The positions returned by the queries refer to the sorted sequence, with duplicates, the container was built on.
+ * The boundaries of the runs are stored in an Elias-Fano structure, so once a key is found among the distinct keys,
+ * @ref equal_range and @ref count take constant time however many times the key is repeated, rather than the
+ * exponential search over the run done by e.g. @ref MappedPGMIndex::upper_bound. The index does not need the
+ * adjustment that @ref PGMIndex applies to runs of duplicate keys either.
+ *
+ * @tparam K the type of the indexed keys
+ * @tparam Epsilon controls the size of the search range on the distinct keys
+ * @tparam EpsilonRecursive controls the size of the search range in the internal structure
+ * @tparam Floating the floating-point type to use for slopes
+ * @tparam Instrumentation the policy that counts the events of the searches, as in @ref PGMIndex. Each query that
+ * searches the distinct keys counts as a search of the index on them
+ */
+template<typename K, size_t Epsilon = 64, size_t EpsilonRecursive = 4, typename Floating = float,
+         typename Instrumentation = NoInstrumentation>
+class RunLengthPGMIndex {
+protected:
+    using Index = PGMIndex<K, Epsilon, EpsilonRecursive, Floating, int32_t, OptimalSegmentation, Instrumentation>;
+
+    size_t n;                 ///< The number of elements this index was built on.
+    std::vector<K> keys;      ///< The distinct keys, in increasing order.
+    sdsl::sd_vector<> starts; ///< The first position of each run, followed by n.
+    Index pgm;                ///< The index on the distinct keys.
+
+    /** Returns the position of the first occurrence of the ith distinct key, or n if i is the number of them. */
+    size_t run_start(size_t i) const { return sdsl::sd_vector<>::select_1_type(&starts)(i + 1); }
+
+    /** Returns the number of distinct keys less than @p key. */
+    size_t rank(const K &key) const {
+        if (keys.empty() || key > keys.back())
+            return keys.size();
+        if (key == keys.back())
+            return keys.size() - 1; // This also keeps the search away from max(), which is the sentinel of pgm
+        return std::distance(keys.begin(), lower_bound_in<Epsilon>(keys.begin(), pgm.search(key), key));
+    }
+
+public:
+
+    static constexpr size_t epsilon_value = Epsilon;
+
+    /**
+     * Constructs an empty container.
+     */
+    RunLengthPGMIndex() : RunLengthPGMIndex(std::vector<K>()) {}
+
+    /**
+     * Constructs the container on the given sorted vector.
+     * @param data the vector of keys, must be sorted
+     */
+    explicit RunLengthPGMIndex(const std::vector<K> &data) : RunLengthPGMIndex(data.begin(), data.end()) {}
+
+    /**
+     * Constructs the container on the sorted keys in the range [first, last).
+     * @param first, last the range containing the sorted keys
+     */
+    template<typename RandomIt>
+    RunLengthPGMIndex(RandomIt first, RandomIt last)
+        : n(std::distance(first, last)),
+          keys(),
+          starts(),
+          pgm() {
+        std::vector<uint64_t> positions;
+        for (size_t i = 0; i < n; ++i) {
+            if (i == 0 || first[i] != first[i - 1]) {
+                keys.push_back(first[i]);
+                positions.push_back(i);
+            }
+        }
+        positions.push_back(n);
+
+        starts = decltype(starts)(positions.begin(), positions.end());
+        pgm = decltype(pgm)(keys.begin(), keys.end());
+    }
+
+    /**
+     * Returns the position of the first element that is not less than (i.e. greater or equal to) @p key.
+     * @param key value to compare the elements to
+     * @return the position of the first element that is not less than @p key, or @ref size() if none is found
+     */
+    size_t lower_bound(const K &key) const { return run_start(rank(key)); }
+
+    /**
+     * Returns the position of the first element that is greater than @p key.
+     * @param key value to compare the elements to
+     * @return the position of the first element that is greater than @p key, or @ref size() if none is found
+     */
+    size_t upper_bound(const K &key) const {
+        auto i = rank(key);
+        return run_start(i + (i < keys.size() && keys[i] == key));
+    }
+
+    /**
+     * Returns the range of positions of the elements equal to @p key.
+     * @param key value to compare the elements to
+     * @return a pair with the first position of an element equal to @p key and the position past the last one, which
+     * are both equal to @ref lower_bound(key) if there is no such element
+     */
+    std::pair<size_t, size_t> equal_range(const K &key) const {
+        auto i = rank(key);
+        auto lo = run_start(i);
+        if (i == keys.size() || keys[i] != key)
+            return {lo, lo};
+        return {lo, run_start(i + 1)};
+    }
+
+    /**
+     * Returns the number of elements equal to @p key.
+     * @param key value of the elements to count
+     * @return the number of elements equal to @p key
+     */
+    size_t count(const K &key) const {
+        auto[lo, hi] = equal_range(key);
+        return hi - lo;
+    }
+
+    /**
+     * Checks if there is an element equal to @p key.
+     * @param key the value of the element to search for
+     * @return @c true if there is such an element, otherwise @c false
+     */
+    bool contains(const K &key) const {
+        auto i = rank(key);
+        return i < keys.size() && keys[i] == key;
+    }
+
+    /**
+     * Returns the number of elements the container was built on, duplicates included.
+     * @return the number of elements
+     */
+    size_t size() const { return n; }
+
+    /**
+     * Returns the number of distinct keys.
+     * @return the number of distinct keys
+     */
+    size_t distinct_count() const { return keys.size(); }
+
+    /**
+     * Returns the size of the container in bytes, that is, of the distinct keys, of the boundaries of their runs and
+     * of the index on them.
+     * @return the size of the container in bytes
+     */
+    size_t size_in_bytes() const {
+        return keys.size() * sizeof(K) + sdsl::size_in_bytes(starts) + pgm.size_in_bytes();
+    }
+};
+
+/**
+ * A disk-backed container storing a sorted sequence of numbers and a @ref PGMIndex for fast search operations.
+ *
+ * @tparam K the type of the indexed keys
+ * @tparam Epsilon controls the size of the returned search range
+ * @tparam EpsilonRecursive controls the size of the search range in the internal structure
+ * @tparam Floating the floating-point type to use for slopes
+ */
+template<typename K, size_t Epsilon, size_t EpsilonRecursive = 4, typename Floating = float>
+class MappedPGMIndex : public PGMIndex<K, Epsilon, EpsilonRecursive, Floating> {
+    using base = PGMIndex<K, Epsilon, EpsilonRecursive, Floating>;
+    using typename base::Segment;
+    std::shared_ptr<const void> file; ///< The mapping of the file backing the container.
+    size_t file_bytes;
+    size_t header_bytes;
+
+public:
+
+    /**
+     * Constructs a new disk-backed container on the sorted keys in the range [first, last).
+     * @param first, last the range containing the sorted keys to copy
+     * @param out_filename the name of the output file
+     */
+    template<class RandomIt>
+    MappedPGMIndex(RandomIt first, RandomIt last, const std::string &out_filename)
+        : base(first, last),
+          file(),
+          file_bytes(),
+          header_bytes() {
+        serialize_and_map(first, last, out_filename);
+    }
+
+    /**
+     * Constructs a new disk-backed container on the sorted keys from the given input file.
+     *
+     * The @p in_filename must be a binary file containing a sorted sequence numbers of type @p K with the same
+     * endianness of the CPU.
+     *
+     * @param in_filename the name of the input file
+     * @param out_filename the name of the output file
+     */
+    MappedPGMIndex(const std::string &in_filename, const std::string &out_filename)
+        : base(),
+          file(),
+          file_bytes(),
+          header_bytes() {
+        // The input is streamed twice, to build the index and to copy it, so it is never entirely in memory
+        BinaryFileReader<K> reader(in_filename);
+        std::vector<Segment> segments;
+        this->n = base::build(reader.begin(), reader.end(), Epsilon, EpsilonRecursive, segments, this->levels_offsets);
+        this->first_key = this->n ? segments.front().key : K(0);
+        this->segments = std::move(segments);
+
+        BinaryFileReader<K> data_reader(in_filename);
+        serialize_and_map(data_reader.begin(), data_reader.end(), out_filename);
+    }
+
+    /**
+     * Loads a disk-backed container from the given file. The segments of the index are used in place in the file.
+     * @param in_filename the name of the input file
+     */
+    explicit MappedPGMIndex(const std::string &in_filename)
+        : base(),
+          file(),
+          file_bytes(),
+          header_bytes() {
+        auto in = std::fstream(in_filename, std::ios::in | std::ios::binary);
+        size_t segments_count;
+        read_member(header_bytes, in);
+        read_member(this->n, in);
+        read_member(this->first_key, in);
+        read_container(this->levels_offsets, in);
+        read_member(segments_count, in);
+        auto segments_offset = size_t(in.tellg());
+        if (!in || segments_offset + segments_count * sizeof(Segment) > header_bytes)
+            throw std::runtime_error("Invalid file " + in_filename);
+
+        file_bytes = header_bytes + this->n * sizeof(K);
+        file = internal::map_file(in_filename, file_bytes);
+        auto first_segment = reinterpret_cast<const Segment *>(static_cast<const char *>(file.get()) + segments_offset);
+        this->segments = internal::MappableArray<Segment>(first_segment, segments_count, file);
+    }
+
+    /**
+     * Checks if there is an element with key equivalent to @p key in the container.
+     * @param key the value of the element to search for
+     * @return @c true if there is such an element, otherwise @c false
+     */
+    bool contains(const K &key) const {
+        auto it = lower_bound(key);
+        return it != end() && *it == key;
+    }
+
+    /**
+     * Returns an iterator pointing to the first element that is not less than (i.e. greater or equal to) @p key.
+     * @param key value to compare the elements to
+     * @return iterator to the first element that is not less than @p key, or @ref end() if no such element is found
+     */
+    auto lower_bound(const K &key) const {
+        return lower_bound_in<Epsilon>(begin(), this->search(key), key);
+    }
+
+    /**
+     * Returns an iterator pointing to the first element that is greater than @p key.
+     * @param key value to compare the elements to
+     * @return iterator to the first element that is greater than @p key, or @ref end() if no such element is found
+     */
+    auto upper_bound(const K &key) const {
+        auto range = this->search(key);
+        auto it = std::upper_bound(begin() + range.lo, begin() + range.hi, key);
+        auto step = 1ull;
+        while (it + step < end() && *(it + step) == key)  // exponential search to skip duplicates
+            step *= 2;
+        return std::upper_bound(it + (step / 2), std::min(it + step, end()), key);
+    }
+
+    /**
+     * Returns the number of elements with key equal to the specified argument.
+     * @param key value of the elements to count
+     * @return the number of elements with key equal to @p key
+     */
+    size_t count(const K &key) const {
+        auto lb = lower_bound(key);
+        if (lb == end() || *lb != key)
+            return 0;
+        return std::distance(lb, upper_bound(key));
+    }
+
+    /**
+     * Returns the number of elements in the container.
+     * @return the number of elements in the container
+     */
+    size_t size() const { return this->n; }
+
+    /**
+     * Returns the size in bytes of the file backing the container.
+     * @return the size in bytes of the file backing the container
+     */
+    size_t file_size_in_bytes() const { return file_bytes; }
+
+    /**
+     * Returns an iterator to the first element of the container.
+     * @return an iterator to the first element of the container
+     */
+    auto begin() const { return (const K *) ((const char *) file.get() + header_bytes); }
+
+    /**
+     * Returns an iterator to the element following the last element of the container.
+     * @return an iterator to the element following the last element of the container
+     */
+    auto end() const { return begin() + size(); }
+
+private:
+
+    template<class RandomIt>
+    void serialize_and_map(RandomIt first, RandomIt last, const std::string &out_filename) {
+        auto out = std::fstream(out_filename, std::ios::out | std::ios::binary);
+        header_bytes += write_member(header_bytes, out);
+        header_bytes += write_member(this->n, out);
+        header_bytes += write_member(this->first_key, out);
+        header_bytes += write_container(this->levels_offsets, out);
+        header_bytes += write_container(this->segments, out);
+        for (auto it = first; it != last; ++it)
+            write_member(*it, out);
+        file_bytes = header_bytes + this->n * sizeof(K);
+        out.seekp(0);
+        write_member(header_bytes, out);
+        out.close();
+        file = internal::map_file(out_filename, file_bytes);
     }
 
     template<typename T>
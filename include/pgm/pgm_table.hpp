@@ -0,0 +1,317 @@
+// This file is part of PGM-index <https://github.com/gvinciguerra/PGM-index>.
+// Copyright (c) 2018 Giorgio Vinciguerra.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "pgm_index.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pgm {
+
+/**
+ * A random-access iterator over the keys of a sequence of records, which are computed on the fly by a key function
+ * applied to the records pointed to by an underlying iterator. It lets a @ref PGMIndex be built and searched on keys
+ * embedded in records without copying them out. The iterator refers to the key function, which must outlive it.
+ *
+ * @tparam RandomIt the random-access iterator over the records
+ * @tparam KeyFn the type of the function that returns the key of a record
+ */
+template<typename RandomIt, typename KeyFn>
+class ProjectionIterator {
+    RandomIt it;         ///< The iterator to the current record.
+    const KeyFn *key_fn; ///< The function that returns the key of a record.
+
+public:
+
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = std::decay_t<std::invoke_result_t<const KeyFn &, decltype(*std::declval<RandomIt>())>>;
+    using difference_type = typename std::iterator_traits<RandomIt>::difference_type;
+    using pointer = const value_type *;
+    using reference = value_type;
+
+    ProjectionIterator() : it(), key_fn(nullptr) {}
+
+    ProjectionIterator(RandomIt it, const KeyFn &key_fn) : it(it), key_fn(&key_fn) {}
+
+    /** Returns the iterator to the current record. */
+    RandomIt base() const { return it; }
+
+    reference operator*() const { return std::invoke(*key_fn, *it); }
+    reference operator[](difference_type n) const { return std::invoke(*key_fn, it[n]); }
+
+    ProjectionIterator &operator++() {
+        ++it;
+        return *this;
+    }
+
+    ProjectionIterator &operator--() {
+        --it;
+        return *this;
+    }
+
+    ProjectionIterator operator++(int) { return {it++, *key_fn}; }
+    ProjectionIterator operator--(int) { return {it--, *key_fn}; }
+
+    ProjectionIterator &operator+=(difference_type n) {
+        it += n;
+        return *this;
+    }
+
+    ProjectionIterator &operator-=(difference_type n) {
+        it -= n;
+        return *this;
+    }
+
+    ProjectionIterator operator+(difference_type n) const { return {it + n, *key_fn}; }
+    ProjectionIterator operator-(difference_type n) const { return {it - n, *key_fn}; }
+    friend ProjectionIterator operator+(difference_type n, const ProjectionIterator &i) { return i + n; }
+    difference_type operator-(const ProjectionIterator &i) const { return it - i.it; }
+
+    bool operator==(const ProjectionIterator &i) const { return it == i.it; }
+    bool operator!=(const ProjectionIterator &i) const { return it != i.it; }
+    bool operator<(const ProjectionIterator &i) const { return it < i.it; }
+    bool operator>(const ProjectionIterator &i) const { return it > i.it; }
+    bool operator<=(const ProjectionIterator &i) const { return it <= i.it; }
+    bool operator>=(const ProjectionIterator &i) const { return it >= i.it; }
+};
+
+/**
+ * A container that owns a sequence of records sorted by a key embedded in them, and uses a @ref PGMIndex for fast
+ * search operations.
+ *
+ * The index is built and searched through a @ref ProjectionIterator on the records, so the keys are never copied out
+ * of them, and the lookups end with the same last-mile search as @ref lower_bound_in. Records with equal keys are kept
+ * in their original order.
+ *
+ * @tparam Record the type of the stored records
+ * @tparam KeyFn the type of the function that returns the key of a record, such as a lambda or a pointer to a member,
+ * which the constructors take unless it is a default-constructible function object
+ * @tparam Epsilon controls the size of the search range of the index
+ * @tparam EpsilonRecursive controls the size of the search range in the internal structure
+ * @tparam Floating the floating-point type to use for slopes
+ */
+template<typename Record, typename KeyFn, size_t Epsilon = 64, size_t EpsilonRecursive = 4, typename Floating = float>
+class PGMTable {
+public:
+    using key_type = std::decay_t<std::invoke_result_t<const KeyFn &, const Record &>>;
+    using value_type = Record;
+    using size_type = size_t;
+    using const_iterator = typename std::vector<Record>::const_iterator;
+
+private:
+    using key_iterator = ProjectionIterator<const_iterator, KeyFn>;
+
+    std::vector<Record> records;                                  ///< The records, sorted by key.
+    KeyFn key_fn;                                                 ///< The function that returns the key of a record.
+    PGMIndex<key_type, Epsilon, EpsilonRecursive, Floating> pgm;  ///< The index on the keys of the records.
+
+    /** Enables the constructors without a key function, which would leave a pointer or a member pointer null. */
+    template<typename F>
+    using if_default_key_fn = std::enable_if_t<std::is_default_constructible_v<F> && !std::is_pointer_v<F>
+                                                   && !std::is_member_pointer_v<F>, int>;
+
+    key_iterator keys_begin() const { return key_iterator(records.begin(), key_fn); }
+    key_iterator keys_end() const { return key_iterator(records.end(), key_fn); }
+
+    /**
+     * Returns an iterator past the run of records with key equivalent to @p key that starts at @p it, the first record
+     * whose key is not less than @p key. The run is skipped with an exponential search, so only the duplicates of
+     * @p key cost more than a compare.
+     */
+    const_iterator run_end(const_iterator it, const key_type &key) const {
+        if (it == end() || this->key(*it) != key)
+            return it;
+        auto first = key_iterator(it, key_fn);
+        auto size = size_t(std::distance(it, end()));
+        size_t step = 1;
+        while (step < size && first[step] == key)
+            step *= 2;
+        return std::upper_bound(first + step / 2, first + std::min(step, size), key).base();
+    }
+
+public:
+
+    static constexpr size_t epsilon_value = Epsilon;
+
+    /**
+     * Constructs an empty container.
+     * @param key_fn the function that returns the key of a record
+     */
+    explicit PGMTable(KeyFn key_fn) : records(), key_fn(key_fn), pgm() {}
+
+    /**
+     * Constructs an empty container with a default-constructed key function.
+     */
+    template<typename F = KeyFn, if_default_key_fn<F> = 0>
+    PGMTable() : PGMTable(KeyFn()) {}
+
+    /**
+     * Constructs the container on the given records, which are sorted by key if they are not already.
+     * @param records the records to store
+     * @param key_fn the function that returns the key of a record
+     */
+    PGMTable(std::vector<Record> records, KeyFn key_fn)
+        : records(std::move(records)),
+          key_fn(key_fn),
+          pgm() {
+        auto cmp = [&](const Record &a, const Record &b) {
+            return std::invoke(this->key_fn, a) < std::invoke(this->key_fn, b);
+        };
+        if (!std::is_sorted(this->records.begin(), this->records.end(), cmp))
+            std::stable_sort(this->records.begin(), this->records.end(), cmp);
+        pgm = decltype(pgm)(keys_begin(), keys_end());
+    }
+
+    /**
+     * Constructs the container on the records in the range [first, last), which are sorted by key if they are not
+     * already.
+     * @param first, last the range containing the records to copy
+     * @param key_fn the function that returns the key of a record
+     */
+    template<typename InputIt>
+    PGMTable(InputIt first, InputIt last, KeyFn key_fn)
+        : PGMTable(std::vector<Record>(first, last), key_fn) {}
+
+    /**
+     * Constructs the container on the given records with a default-constructed key function.
+     * @param records the records to store
+     */
+    template<typename F = KeyFn, if_default_key_fn<F> = 0>
+    explicit PGMTable(std::vector<Record> records) : PGMTable(std::move(records), KeyFn()) {}
+
+    /**
+     * Constructs the container on the records in the range [first, last) with a default-constructed key function.
+     * @param first, last the range containing the records to copy
+     */
+    template<typename InputIt, typename F = KeyFn, if_default_key_fn<F> = 0>
+    PGMTable(InputIt first, InputIt last) : PGMTable(std::vector<Record>(first, last), KeyFn()) {}
+
+    /**
+     * Returns the key of the given record.
+     * @param record a record
+     * @return the key of @p record
+     */
+    key_type key(const Record &record) const { return std::invoke(key_fn, record); }
+
+    /**
+     * Returns an iterator to a record with key equivalent to @p key.
+     * @param key the value of the key to search for
+     * @return an iterator to the first record with key equivalent to @p key, or @ref end() if none is found
+     */
+    const_iterator find(const key_type &key) const {
+        auto it = lower_bound(key);
+        return it != end() && this->key(*it) == key ? it : end();
+    }
+
+    /**
+     * Checks if there is a record with key equivalent to @p key in the container.
+     * @param key the value of the key to search for
+     * @return @c true if there is such a record, otherwise @c false
+     */
+    bool contains(const key_type &key) const { return find(key) != end(); }
+
+    /**
+     * Returns an iterator pointing to the first record whose key is not less than (i.e. greater or equal to) @p key.
+     * @param key value to compare the keys to
+     * @return iterator to the first record whose key is not less than @p key, or @ref end() if none is found
+     */
+    const_iterator lower_bound(const key_type &key) const {
+        if (records.empty())
+            return end();
+        return lower_bound_in<Epsilon>(keys_begin(), pgm.search(key), key).base();
+    }
+
+    /**
+     * Returns an iterator pointing to the first record whose key is greater than @p key.
+     * @param key value to compare the keys to
+     * @return iterator to the first record whose key is greater than @p key, or @ref end() if none is found
+     */
+    const_iterator upper_bound(const key_type &key) const { return run_end(lower_bound(key), key); }
+
+    /**
+     * Returns the range of records with key equivalent to @p key.
+     * @param key value to compare the keys to
+     * @return a pair of iterators to the first record with key equivalent to @p key and past the last one
+     */
+    std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const {
+        auto lb = lower_bound(key);
+        return {lb, run_end(lb, key)};
+    }
+
+    /**
+     * Returns the number of records with key equivalent to @p key.
+     * @param key value of the keys to count
+     * @return the number of records with key equivalent to @p key
+     */
+    size_t count(const key_type &key) const {
+        auto[first, last] = equal_range(key);
+        return std::distance(first, last);
+    }
+
+    /**
+     * Returns the range of records with key between and including @p lo and @p hi.
+     * @param lo lower endpoint of the range query
+     * @param hi upper endpoint of the range query, must be greater than or equal to @p lo
+     * @return a pair of iterators to the first record in the range and past the last one
+     */
+    std::pair<const_iterator, const_iterator> range(const key_type &lo, const key_type &hi) const {
+        return {lower_bound(lo), upper_bound(hi)};
+    }
+
+    /**
+     * Returns an iterator to the first record of the container.
+     * @return an iterator to the first record
+     */
+    const_iterator begin() const { return records.cbegin(); }
+
+    /**
+     * Returns an iterator to the record following the last record of the container.
+     * @return an iterator to the record following the last record
+     */
+    const_iterator end() const { return records.cend(); }
+
+    /**
+     * Returns the number of records in the container.
+     * @return the number of records in the container
+     */
+    size_t size() const { return records.size(); }
+
+    /**
+     * Returns true if the container is empty.
+     * @return true if the container is empty
+     */
+    bool empty() const { return records.empty(); }
+
+    /**
+     * Returns the index on the keys of the records.
+     * @return the index on the keys of the records
+     */
+    const auto &index() const { return pgm; }
+
+    /**
+     * Returns the size of the index in bytes.
+     * @return the size of the index in bytes
+     */
+    size_t index_size_in_bytes() const { return pgm.size_in_bytes(); }
+};
+
+}
@@ -18,6 +18,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <exception>
 #include <iterator>
 #include <limits>
 #include <stdexcept>
@@ -40,23 +41,32 @@ using LargeSigned = typename std::conditional_t<std::is_floating_point_v<T>,
                                                 long double,
                                                 std::conditional_t<(sizeof(T) < 8), int64_t, __int128>>;
 
+template<typename X, typename Y>
+class ShrinkingConeModel;
+
 template<typename X, typename Y>
 class OptimalPiecewiseLinearModel {
 private:
+    template<typename, typename> friend class ShrinkingConeModel;
+
     using SX = LargeSigned<X>;
     using SY = LargeSigned<Y>;
 
-    struct Slope {
-        SX dx{};
-        SY dy{};
+    template<typename DX, typename DY>
+    struct BasicSlope {
+        DX dx{};
+        DY dy{};
 
-        bool operator<(const Slope &p) const { return dy * p.dx < dx * p.dy; }
-        bool operator>(const Slope &p) const { return dy * p.dx > dx * p.dy; }
-        bool operator==(const Slope &p) const { return dy * p.dx == dx * p.dy; }
-        bool operator!=(const Slope &p) const { return dy * p.dx != dx * p.dy; }
+        bool operator<(const BasicSlope &p) const { return dy * p.dx < dx * p.dy; }
+        bool operator>(const BasicSlope &p) const { return dy * p.dx > dx * p.dy; }
+        bool operator==(const BasicSlope &p) const { return dy * p.dx == dx * p.dy; }
+        bool operator!=(const BasicSlope &p) const { return dy * p.dx != dx * p.dy; }
         explicit operator long double() const { return dy / (long double) dx; }
     };
 
+    using Slope = BasicSlope<SX, SY>;
+    using FastSlope = BasicSlope<int64_t, int64_t>; ///< Used when the products of the differences fit in 64 bits.
+
     struct Point {
         X x{};
         Y y{};
@@ -69,77 +79,68 @@ private:
     std::vector<Point> upper;
     X first_x = 0;
     X last_x = 0;
+    Y min_hull_y = 0;
+    Y max_hull_y = 0;
     size_t lower_start = 0;
     size_t upper_start = 0;
     size_t points_in_hull = 0;
     Point rectangle[4];
 
-    auto cross(const Point &O, const Point &A, const Point &B) const {
-        auto OA = A - O;
-        auto OB = B - O;
-        return OA.dx * OB.dy - OA.dy * OB.dx;
+    /**
+     * Returns a - b as a D. If D is not wider than T, an integer T is subtracted in its unsigned type and the result
+     * is reinterpreted as signed, which is exact when the difference fits in D, as it does for @ref FastSlope.
+     */
+    template<typename D, typename T>
+    static D difference(const T &a, const T &b) {
+        if constexpr (std::is_integral_v<T> && sizeof(D) <= sizeof(T))
+            return D(std::make_signed_t<T>(std::make_unsigned_t<T>(a) - std::make_unsigned_t<T>(b)));
+        else
+            return D(a) - D(b);
     }
 
-public:
-
-    class CanonicalSegment;
-
-    explicit OptimalPiecewiseLinearModel(Y epsilon) : epsilon(epsilon), lower(), upper() {
-        if (epsilon < 0)
-            throw std::invalid_argument("epsilon cannot be negative");
-
-        upper.reserve(1u << 16);
-        lower.reserve(1u << 16);
+    template<typename S>
+    static S delta(const Point &a, const Point &b) {
+        return {difference<decltype(S::dx)>(a.x, b.x), difference<decltype(S::dy)>(a.y, b.y)};
     }
 
-    bool add_point(const X &x, const Y &y) {
-        if (points_in_hull > 0 && x <= last_x)
-            throw std::logic_error("Points must be increasing by x.");
-
-        last_x = x;
-        auto max_y = std::numeric_limits<Y>::max();
-        auto min_y = std::numeric_limits<Y>::lowest();
-        Point p1{x, y >= max_y - epsilon ? max_y : y + epsilon};
-        Point p2{x, y <= min_y + epsilon ? min_y : y - epsilon};
-
-        if (points_in_hull == 0) {
-            first_x = x;
-            rectangle[0] = p1;
-            rectangle[1] = p2;
-            upper.clear();
-            lower.clear();
-            upper.push_back(p1);
-            lower.push_back(p2);
-            upper_start = lower_start = 0;
-            ++points_in_hull;
-            return true;
-        }
+    template<typename S>
+    static auto cross(const Point &O, const Point &A, const Point &B) {
+        auto OA = delta<S>(A, O);
+        auto OB = delta<S>(B, O);
+        return OA.dx * OB.dy - OA.dy * OB.dx;
+    }
 
-        if (points_in_hull == 1) {
-            rectangle[2] = p2;
-            rectangle[3] = p1;
-            upper.push_back(p1);
-            lower.push_back(p2);
-            ++points_in_hull;
-            return true;
+    /**
+     * Returns whether the products of two differences of coordinates of the points of the hull, and the differences
+     * of two such products, fit in 64 bits, so that @ref FastSlope can be used instead of @ref Slope.
+     */
+    bool fits_in_64_bits() const {
+        if constexpr (std::is_integral_v<X> && std::is_integral_v<Y>) {
+            auto span_x = static_cast<unsigned __int128>(SX(last_x) - first_x);
+            auto span_y = static_cast<unsigned __int128>(SY(max_hull_y) - min_hull_y);
+            return span_x * span_y < (static_cast<unsigned __int128>(1) << 62);
         }
+        return false;
+    }
 
-        auto slope1 = rectangle[2] - rectangle[0];
-        auto slope2 = rectangle[3] - rectangle[1];
-        bool outside_line1 = p1 - rectangle[2] < slope1;
-        bool outside_line2 = p2 - rectangle[3] > slope2;
+    template<typename S>
+    bool add_point_to_hull(const Point &p1, const Point &p2) {
+        auto slope1 = delta<S>(rectangle[2], rectangle[0]);
+        auto slope2 = delta<S>(rectangle[3], rectangle[1]);
+        bool outside_line1 = delta<S>(p1, rectangle[2]) < slope1;
+        bool outside_line2 = delta<S>(p2, rectangle[3]) > slope2;
 
         if (outside_line1 || outside_line2) {
             points_in_hull = 0;
             return false;
         }
 
-        if (p1 - rectangle[1] < slope2) {
+        if (delta<S>(p1, rectangle[1]) < slope2) {
             // Find extreme slope
-            auto min = lower[lower_start] - p1;
+            auto min = delta<S>(lower[lower_start], p1);
             auto min_i = lower_start;
             for (auto i = lower_start + 1; i < lower.size(); i++) {
-                auto val = lower[i] - p1;
+                auto val = delta<S>(lower[i], p1);
                 if (val > min)
                     break;
                 min = val;
@@ -152,18 +153,18 @@ public:
 
             // Hull update
             auto end = upper.size();
-            for (; end >= upper_start + 2 && cross(upper[end - 2], upper[end - 1], p1) <= 0; --end)
+            for (; end >= upper_start + 2 && cross<S>(upper[end - 2], upper[end - 1], p1) <= 0; --end)
                 continue;
             upper.resize(end);
             upper.push_back(p1);
         }
 
-        if (p2 - rectangle[0] > slope1) {
+        if (delta<S>(p2, rectangle[0]) > slope1) {
             // Find extreme slope
-            auto max = upper[upper_start] - p2;
+            auto max = delta<S>(upper[upper_start], p2);
             auto max_i = upper_start;
             for (auto i = upper_start + 1; i < upper.size(); i++) {
-                auto val = upper[i] - p2;
+                auto val = delta<S>(upper[i], p2);
                 if (val < max)
                     break;
                 max = val;
@@ -176,7 +177,7 @@ public:
 
             // Hull update
             auto end = lower.size();
-            for (; end >= lower_start + 2 && cross(lower[end - 2], lower[end - 1], p2) >= 0; --end)
+            for (; end >= lower_start + 2 && cross<S>(lower[end - 2], lower[end - 1], p2) >= 0; --end)
                 continue;
             lower.resize(end);
             lower.push_back(p2);
@@ -186,7 +187,75 @@ public:
         return true;
     }
 
-    CanonicalSegment get_segment() {
+public:
+
+    class CanonicalSegment;
+
+    /** The memory of the convex hull of a model, which a model can borrow and give back to be reused by the next. */
+    class Hull {
+        friend class OptimalPiecewiseLinearModel;
+        std::vector<Point> lower;
+        std::vector<Point> upper;
+
+    public:
+
+        size_t size_in_bytes() const { return (lower.capacity() + upper.capacity()) * sizeof(Point); }
+    };
+
+    explicit OptimalPiecewiseLinearModel(Y epsilon) : epsilon(epsilon), lower(), upper() {
+        if (epsilon < 0)
+            throw std::invalid_argument("epsilon cannot be negative");
+    }
+
+    /** Constructs a model that borrows the memory of @p hull, until it is given back with @ref release. */
+    OptimalPiecewiseLinearModel(Y epsilon, Hull &hull) : OptimalPiecewiseLinearModel(epsilon) {
+        lower.swap(hull.lower);
+        upper.swap(hull.upper);
+    }
+
+    bool add_point(const X &x, const Y &y) {
+        if (points_in_hull > 0 && x <= last_x)
+            throw std::logic_error("Points must be increasing by x.");
+
+        last_x = x;
+        auto max_y = std::numeric_limits<Y>::max();
+        auto min_y = std::numeric_limits<Y>::lowest();
+        Point p1{x, y >= max_y - epsilon ? max_y : y + epsilon};
+        Point p2{x, y <= min_y + epsilon ? min_y : y - epsilon};
+
+        if (points_in_hull == 0) {
+            first_x = x;
+            min_hull_y = p2.y;
+            max_hull_y = p1.y;
+            rectangle[0] = p1;
+            rectangle[1] = p2;
+            upper.clear();
+            lower.clear();
+            upper.push_back(p1);
+            lower.push_back(p2);
+            upper_start = lower_start = 0;
+            ++points_in_hull;
+            return true;
+        }
+
+        min_hull_y = std::min(min_hull_y, p2.y);
+        max_hull_y = std::max(max_hull_y, p1.y);
+
+        if (points_in_hull == 1) {
+            rectangle[2] = p2;
+            rectangle[3] = p1;
+            upper.push_back(p1);
+            lower.push_back(p2);
+            ++points_in_hull;
+            return true;
+        }
+
+        if (fits_in_64_bits())
+            return add_point_to_hull<FastSlope>(p1, p2);
+        return add_point_to_hull<Slope>(p1, p2);
+    }
+
+    CanonicalSegment get_segment() const {
         if (points_in_hull == 1)
             return CanonicalSegment(rectangle[0], rectangle[1], first_x);
         return CanonicalSegment(rectangle, first_x);
@@ -197,11 +266,19 @@ public:
         lower.clear();
         upper.clear();
     }
+
+    /** Resets the model and gives back the memory borrowed from @p hull, with the capacity it has grown to. */
+    void release(Hull &hull) {
+        reset();
+        lower.swap(hull.lower);
+        upper.swap(hull.upper);
+    }
 };
 
 template<typename X, typename Y>
 class OptimalPiecewiseLinearModel<X, Y>::CanonicalSegment {
     friend class OptimalPiecewiseLinearModel;
+    template<typename, typename> friend class ShrinkingConeModel;
 
     Point rectangle[4];
     X first;
@@ -271,8 +348,162 @@ public:
     }
 };
 
-template<typename Fin, typename Fout>
-size_t make_segmentation(size_t n, size_t epsilon, Fin in, Fout out) {
+/**
+ * A greedy model that fixes each segment at its first point and shrinks the cone of the slopes that keep the points
+ * added so far within epsilon. Each point is processed in constant time and space, but the segments are not optimal,
+ * so there are usually more of them than with @ref OptimalPiecewiseLinearModel.
+ *
+ * The segments are of the same type as those of @ref OptimalPiecewiseLinearModel, so the two are interchangeable.
+ */
+template<typename X, typename Y>
+class ShrinkingConeModel {
+    using Base = OptimalPiecewiseLinearModel<X, Y>;
+    using Point = typename Base::Point;
+
+public:
+
+    using CanonicalSegment = typename Base::CanonicalSegment;
+    using Hull = typename Base::Hull;
+
+private:
+
+    const Y epsilon;
+    Point origin;         ///< The first point of the segment, through which the segment passes.
+    Point lower;          ///< The point that bounds the slope of the segment from below.
+    Point upper;          ///< The point that bounds the slope of the segment from above.
+    X last_x = 0;
+    size_t points_in_cone = 0;
+
+public:
+
+    explicit ShrinkingConeModel(Y epsilon) : epsilon(epsilon) {
+        if (epsilon < 0)
+            throw std::invalid_argument("epsilon cannot be negative");
+    }
+
+    /** Constructs a model. The model needs no memory other than its own, so @p hull is not used. */
+    ShrinkingConeModel(Y epsilon, Hull &) : ShrinkingConeModel(epsilon) {}
+
+    bool add_point(const X &x, const Y &y) {
+        if (points_in_cone > 0 && x <= last_x)
+            throw std::logic_error("Points must be increasing by x.");
+
+        last_x = x;
+        auto max_y = std::numeric_limits<Y>::max();
+        auto min_y = std::numeric_limits<Y>::lowest();
+        Point p1{x, y >= max_y - epsilon ? max_y : y + epsilon};
+        Point p2{x, y <= min_y + epsilon ? min_y : y - epsilon};
+
+        if (points_in_cone == 0) {
+            origin = {x, y};
+            ++points_in_cone;
+            return true;
+        }
+
+        if (points_in_cone == 1) {
+            lower = p2;
+            upper = p1;
+            ++points_in_cone;
+            return true;
+        }
+
+        auto max_slope = p1 - origin;
+        auto min_slope = p2 - origin;
+        if (max_slope < lower - origin || min_slope > upper - origin) {
+            points_in_cone = 0;
+            return false;
+        }
+
+        if (min_slope > lower - origin)
+            lower = p2;
+        if (max_slope < upper - origin)
+            upper = p1;
+        ++points_in_cone;
+        return true;
+    }
+
+    CanonicalSegment get_segment() const {
+        if (points_in_cone == 1)
+            return CanonicalSegment(origin, origin, origin.x);
+        return CanonicalSegment({origin, origin, lower, upper}, origin.x);
+    }
+
+    void reset() { points_in_cone = 0; }
+
+    void release(Hull &) { reset(); }
+};
+
+}
+
+namespace pgm {
+
+/** Segmentation policy that computes the minimum number of segments, in amortised constant time per point. */
+struct OptimalSegmentation {
+    template<typename X, typename Y>
+    using model = internal::OptimalPiecewiseLinearModel<X, Y>;
+};
+
+/**
+ * Segmentation policy that computes segments faster, in constant time per point, with the greedy shrinking-cone
+ * algorithm. It guarantees the same error bound, but usually produces more segments than @ref OptimalSegmentation.
+ */
+struct ShrinkingConeSegmentation {
+    template<typename X, typename Y>
+    using model = internal::ShrinkingConeModel<X, Y>;
+};
+
+/**
+ * The memory that the segmentation algorithm uses in the construction of an index, kept across constructions, so
+ * that successive ones do not allocate it again. It grows on demand to the largest convex hull met so far, with one
+ * hull for each thread of a parallel construction.
+ *
+ * A workspace must not be used by two constructions at the same time.
+ *
+ * @tparam X the type of the keys
+ * @tparam Y the type of the positions
+ */
+template<typename X, typename Y = size_t>
+class SegmentationWorkspace {
+    using Hull = typename internal::OptimalPiecewiseLinearModel<X, Y>::Hull;
+    std::vector<Hull> hulls;
+
+public:
+
+    /** Makes room for the hulls of @p threads models used at the same time. */
+    void reserve(size_t threads) {
+        if (hulls.size() < threads)
+            hulls.resize(threads);
+    }
+
+    /** Returns the hull for the model of the given thread. Use @ref reserve before the threads start. */
+    Hull &hull(size_t thread) {
+        reserve(thread + 1);
+        return hulls[thread];
+    }
+
+    /**
+     * Returns the size in bytes of the memory held by the workspace.
+     * @return the size in bytes of the workspace
+     */
+    size_t size_in_bytes() const {
+        size_t bytes = hulls.capacity() * sizeof(Hull);
+        for (auto &h : hulls)
+            bytes += h.size_in_bytes();
+        return bytes;
+    }
+};
+
+}
+
+namespace pgm::internal {
+
+template<typename Fin>
+using segmentation_workspace_t = SegmentationWorkspace<typename std::invoke_result_t<Fin, size_t>::first_type,
+                                                       typename std::invoke_result_t<Fin, size_t>::second_type>;
+
+template<typename Segmentation = OptimalSegmentation, typename Fin, typename Fout>
+size_t make_segmentation(size_t n, size_t epsilon, Fin in, Fout out,
+                         segmentation_workspace_t<Fin> *workspace = nullptr) {
     if (n == 0)
         return 0;
 
@@ -281,7 +512,9 @@ size_t make_segmentation(size_t n, size_t epsilon, Fin in, Fout out) {
     size_t c = 0;
     auto p = in(0);
 
-    OptimalPiecewiseLinearModel<X, Y> opt(epsilon);
+    segmentation_workspace_t<Fin> local;
+    auto &hull = (workspace ? *workspace : local).hull(0);
+    typename Segmentation::template model<X, Y> opt(epsilon, hull);
     opt.add_point(p.first, p.second);
 
     for (size_t i = 1; i < n; ++i) {
@@ -297,52 +530,224 @@ size_t make_segmentation(size_t n, size_t epsilon, Fin in, Fout out) {
     }
 
     out(opt.get_segment());
+    opt.release(hull);
     return ++c;
 }
 
-template<typename Fin, typename Fout>
-size_t make_segmentation_par(size_t n, size_t epsilon, Fin in, Fout out) {
-    auto parallelism = std::min(std::min(omp_get_num_procs(), omp_get_max_threads()), 20);
-    auto chunk_size = n / parallelism;
-    auto c = 0ull;
+/**
+ * Segments the points in(first), ..., in(last - 1) as @ref make_segmentation does, and calls out(cs, i) for each
+ * segment cs, where i is the index of its first point. The model borrows the memory of @p hull.
+ */
+template<typename Segmentation = OptimalSegmentation, typename Fin, typename Fout, typename Hull>
+void make_segmentation_range(size_t first, size_t last, size_t epsilon, Fin in, Fout out, Hull &hull) {
+    if (first == last)
+        return;
+
+    using X = typename std::invoke_result_t<Fin, size_t>::first_type;
+    using Y = typename std::invoke_result_t<Fin, size_t>::second_type;
+    auto p = in(first);
+    auto start = first;
+
+    typename Segmentation::template model<X, Y> opt(epsilon, hull);
+    opt.add_point(p.first, p.second);
+
+    for (auto i = first + 1; i < last; ++i) {
+        auto next_p = in(i);
+        if (next_p.first == p.first)
+            continue;
+        p = next_p;
+        if (!opt.add_point(p.first, p.second)) {
+            out(opt.get_segment(), start);
+            opt.add_point(p.first, p.second);
+            start = i;
+        }
+    }
+
+    out(opt.get_segment(), start);
+    opt.release(hull);
+}
 
-    if (parallelism == 1 || n < 1ull << 15)
-        return make_segmentation(n, epsilon, in, out);
+/** Returns the number of chunks that @ref make_segmentation_par uses by default on @p n points. */
+inline size_t default_segmentation_parallelism(size_t n) {
+    auto threads = size_t(std::min(omp_get_num_procs(), omp_get_max_threads()));
+    return std::min(threads, n >> 14);
+}
 
+/**
+ * Segments the points in chunks, in parallel, and then repairs the segments across the seams between the chunks, so
+ * that the result is the same as that of @ref make_segmentation.
+ *
+ * The segmentation is greedy, so it is determined by the first point of a segment. The last segment of a chunk is
+ * cut by the end of the chunk, so it is recomputed from its first point across the seam, until a recomputed segment
+ * starts at the same point as a segment of the following chunks, from which on their segments are correct.
+ *
+ * @return the chunks, each with its segments, the range [keep_begin, keep_end) of them that are correct, and the
+ * recomputed segments that follow them
+ */
+template<typename Segmentation = OptimalSegmentation, typename Fin>
+auto make_segmentation_chunks(size_t n, size_t epsilon, Fin in, size_t parallelism,
+                              segmentation_workspace_t<Fin> &workspace) {
     using X = typename std::invoke_result_t<Fin, size_t>::first_type;
     using Y = typename std::invoke_result_t<Fin, size_t>::second_type;
-    using canonical_segment = typename OptimalPiecewiseLinearModel<X, Y>::CanonicalSegment;
-    std::vector<std::vector<canonical_segment>> results(parallelism);
-
-    #pragma omp parallel for reduction(+:c) num_threads(parallelism)
-    for (auto i = 0; i < parallelism; ++i) {
-        auto first = i * chunk_size;
-        auto last = i == parallelism - 1 ? n : first + chunk_size;
-        if (first > 0) {
-            for (; first < last; ++first)
-                if (in(first).first != in(first - 1).first)
-                    break;
-            if (first == last)
+    using canonical_segment = typename Segmentation::template model<X, Y>::CanonicalSegment;
+
+    struct Chunk {
+        std::vector<canonical_segment> segments; ///< The segments of the chunk computed independently.
+        std::vector<size_t> starts;              ///< The index of the first point of each segment.
+        size_t keep_begin = 0;                   ///< The first segment that is part of the result.
+        size_t keep_end = 0;                     ///< One past the last segment that is part of the result.
+        std::vector<canonical_segment> seam;     ///< The segments recomputed across the seam after the chunk.
+    };
+
+    // Split the points into chunks that do not break runs of points with equal x
+    std::vector<size_t> bounds{0};
+    for (size_t c = 1; c < parallelism; ++c) {
+        auto b = std::max(bounds.back() + 1, c * n / parallelism);
+        while (b < n && in(b).first == in(b - 1).first)
+            ++b;
+        if (b >= n)
+            break;
+        bounds.push_back(b);
+    }
+    bounds.push_back(n);
+
+    auto chunks = bounds.size() - 1;
+    std::vector<Chunk> result(chunks);
+    workspace.reserve(chunks);
+
+    #pragma omp parallel for num_threads(chunks)
+    for (auto c = 0; c < int(chunks); ++c) {
+        auto &chunk = result[c];
+        chunk.segments.reserve((bounds[c + 1] - bounds[c]) / (epsilon > 0 ? epsilon * epsilon : 16));
+        make_segmentation_range<Segmentation>(bounds[c], bounds[c + 1], epsilon, in, [&](const auto &cs, size_t start) {
+            chunk.segments.push_back(cs);
+            chunk.starts.push_back(start);
+        }, workspace.hull(c));
+        chunk.keep_end = chunk.segments.size();
+    }
+
+    for (size_t c = 0; c + 1 < chunks;) {
+        auto &chunk = result[c];
+        auto start = chunk.starts[--chunk.keep_end];
+        auto p = in(start);
+        auto &hull = workspace.hull(0);
+        typename Segmentation::template model<X, Y> opt(epsilon, hull);
+        opt.add_point(p.first, p.second);
+
+        auto d = c + 1;
+        auto synced = false;
+        for (auto i = start + 1; i < n && !synced; ++i) {
+            auto next_p = in(i);
+            if (next_p.first == p.first)
+                continue;
+            p = next_p;
+            if (opt.add_point(p.first, p.second))
                 continue;
+
+            chunk.seam.push_back(opt.get_segment());
+            opt.add_point(p.first, p.second);
+            for (; i >= bounds[d + 1]; ++d)
+                result[d].keep_begin = result[d].keep_end; // The chunk is entirely covered by the seam
+            auto &next = result[d];
+            auto it = std::lower_bound(next.starts.begin(), next.starts.end(), i);
+            if (it != next.starts.end() && *it == i) {
+                next.keep_begin = std::distance(next.starts.begin(), it);
+                synced = true;
+            }
         }
 
-        auto in_fun = [in, first](auto j) { return in(first + j); };
-        auto out_fun = [&results, i](const auto &cs) { results[i].emplace_back(cs); };
-        results[i].reserve(chunk_size / (epsilon > 0 ? epsilon * epsilon : 16));
-        c += make_segmentation(last - first, epsilon, in_fun, out_fun);
+        if (!synced) {
+            chunk.seam.push_back(opt.get_segment());
+            opt.release(hull);
+            for (d = c + 1; d < chunks; ++d)
+                result[d].keep_begin = result[d].keep_end;
+            break;
+        }
+        opt.release(hull);
+        c = d;
     }
 
-    for (auto &v : results)
-        for (auto &cs : v)
-            out(cs);
+    return result;
+}
 
+/**
+ * Segments the points in(0), ..., in(n - 1) in parallel, calling out(cs) for each segment cs in order. The result is
+ * the same as that of @ref make_segmentation.
+ * @param parallelism the number of chunks to segment in parallel, or 0 to choose it automatically
+ * @param workspace the memory to reuse for the segmentation, or nullptr to allocate it
+ * @return the number of segments
+ */
+template<typename Segmentation = OptimalSegmentation, typename Fin, typename Fout>
+size_t make_segmentation_par(size_t n, size_t epsilon, Fin in, Fout out, size_t parallelism = 0,
+                             segmentation_workspace_t<Fin> *workspace = nullptr) {
+    if (parallelism == 0)
+        parallelism = default_segmentation_parallelism(n);
+    if (parallelism <= 1)
+        return make_segmentation<Segmentation>(n, epsilon, in, out, workspace);
+
+    size_t c = 0;
+    segmentation_workspace_t<Fin> local;
+    auto &ws = workspace ? *workspace : local;
+    for (auto &chunk : make_segmentation_chunks<Segmentation>(n, epsilon, in, parallelism, ws)) {
+        for (auto i = chunk.keep_begin; i < chunk.keep_end; ++i)
+            out(chunk.segments[i]);
+        for (auto &cs : chunk.seam)
+            out(cs);
+        c += chunk.keep_end - chunk.keep_begin + chunk.seam.size();
+    }
     return c;
 }
 
-template<typename RandomIt>
+/**
+ * Segments the points in(0), ..., in(n - 1) in parallel, and appends the segments to @p out, converted to type @p T.
+ * Unlike @ref make_segmentation_par, the conversions are done in parallel, directly into their final position.
+ * @param parallelism the number of chunks to segment in parallel, or 0 to choose it automatically
+ * @param workspace the memory to reuse for the segmentation, or nullptr to allocate it
+ * @return the number of segments
+ */
+template<typename T, typename Segmentation = OptimalSegmentation, typename Fin>
+size_t make_segmentation_par_into(size_t n, size_t epsilon, Fin in, std::vector<T> &out, size_t parallelism = 0,
+                                  segmentation_workspace_t<Fin> *workspace = nullptr) {
+    if (parallelism == 0)
+        parallelism = default_segmentation_parallelism(n);
+    if (parallelism <= 1)
+        return make_segmentation<Segmentation>(n, epsilon, in, [&](const auto &cs) { out.emplace_back(cs); },
+                                               workspace);
+
+    segmentation_workspace_t<Fin> local;
+    auto chunks = make_segmentation_chunks<Segmentation>(n, epsilon, in, parallelism, workspace ? *workspace : local);
+    std::vector<size_t> offsets(chunks.size() + 1, out.size());
+    for (size_t c = 0; c < chunks.size(); ++c)
+        offsets[c + 1] = offsets[c] + chunks[c].keep_end - chunks[c].keep_begin + chunks[c].seam.size();
+
+    auto first = out.size();
+    out.resize(offsets.back());
+    std::exception_ptr error;
+
+    #pragma omp parallel for num_threads(chunks.size())
+    for (auto c = 0; c < int(chunks.size()); ++c) {
+        try {
+            auto it = out.begin() + offsets[c];
+            auto &chunk = chunks[c];
+            for (auto i = chunk.keep_begin; i < chunk.keep_end; ++i)
+                *it++ = T(chunk.segments[i]);
+            for (auto &cs : chunk.seam)
+                *it++ = T(cs);
+        } catch (...) {
+            #pragma omp critical
+            error = std::current_exception();
+        }
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+    return out.size() - first;
+}
+
+template<typename Segmentation = OptimalSegmentation, typename RandomIt>
 auto make_segmentation(RandomIt first, RandomIt last, size_t epsilon) {
     using key_type = typename RandomIt::value_type;
-    using canonical_segment = typename OptimalPiecewiseLinearModel<key_type, size_t>::CanonicalSegment;
+    using canonical_segment = typename Segmentation::template model<key_type, size_t>::CanonicalSegment;
     using pair_type = typename std::pair<key_type, size_t>;
 
     size_t n = std::distance(first, last);
@@ -351,7 +756,7 @@ auto make_segmentation(RandomIt first, RandomIt last, size_t epsilon) {
 
     auto in_fun = [first](auto i) { return pair_type(first[i], i); };
     auto out_fun = [&out](const auto &cs) { out.push_back(cs); };
-    make_segmentation(n, epsilon, in_fun, out_fun);
+    make_segmentation<Segmentation>(n, epsilon, in_fun, out_fun);
 
     return out;
 }
@@ -0,0 +1,295 @@
+// This file is part of PGM-index <https://github.com/gvinciguerra/PGM-index>.
+// Copyright (c) 2018 Giorgio Vinciguerra.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace pgm::internal {
+
+#pragma pack(push, 1)
+
+/**
+ * A segment of a piecewise polynomial model. It maps a key x not less than @c first_x to the position
+ * first + c[0] u + ... + c[Degree - 1] u^Degree, where u = (x - first_x) @c scale and c are the @c coefficients.
+ *
+ * The polynomial passes through the position of the first key, which is stored exactly, and the other coefficients
+ * are stored as @c float. The fixed @c scale of the key differences keeps them within the range of a @c float for any
+ * span of integer keys, so a segment takes only 4 * Degree bytes more than the key and the position.
+ */
+template<typename X, size_t Degree>
+struct PolynomialSegment {
+    static constexpr double scale = std::is_integral_v<X> ? 1. / double(uint64_t(1) << (4 * sizeof(X))) : 1.;
+
+    X first_x;                              ///< The first key of the segment.
+    uint32_t first;                         ///< The position of the first key of the segment.
+    std::array<float, Degree> coefficients; ///< The coefficients of the polynomial, from the linear term.
+
+    /** Returns x - origin as a double, where x must not be less than origin. */
+    static double delta(const X &x, const X &origin) {
+        if constexpr (std::is_integral_v<X>)
+            return static_cast<double>(std::make_unsigned_t<X>(x) - std::make_unsigned_t<X>(origin));
+        else
+            return static_cast<double>(x) - static_cast<double>(origin);
+    }
+
+    /** Returns the value at @p u of the polynomial without its constant term. */
+    double polynomial(double u) const {
+        double result = coefficients[Degree - 1];
+        for (auto i = Degree - 1; i-- > 0;)
+            result = result * u + coefficients[i];
+        return result * u;
+    }
+
+    /** Returns the value of the polynomial at @p x. */
+    double operator()(const X &x) const { return first + polynomial(delta(x, first_x) * scale); }
+
+    /** Returns the position predicted for @p x, clamped to [0, bound]. */
+    size_t position(const X &x, size_t bound) const {
+        auto p = (*this)(x);
+        return p <= 0 ? 0 : size_t(std::min(p, double(bound)));
+    }
+};
+
+#pragma pack(pop)
+
+/**
+ * Fits polynomials of degree at most @p Degree to ranges of points, such that the positions they predict for the keys
+ * of the points are within epsilon from the positions of the points.
+ *
+ * A polynomial through the first point is fitted by least squares to the others and then checked against the maximum
+ * error, so it is accepted only if the guarantee holds with the same rounded coefficients and floating-point arithmetic
+ * that are used to search. It must also be non-decreasing from
+ * the first point to the first point of the next range, so that the keys in between are predicted between the
+ * positions of the points around them.
+ */
+template<typename X, size_t Degree>
+class PolynomialFitter {
+    static_assert(Degree >= 1 && Degree <= 3, "Only polynomials of degree 1, 2 or 3 are supported");
+
+    using segment_type = PolynomialSegment<X, Degree>;
+
+    const std::vector<std::pair<X, size_t>> &points;
+    const size_t epsilon;
+    const size_t n;
+
+    /** Solves the linear system m a = b, where m is symmetric positive definite, with Gaussian elimination. */
+    static bool solve(long double (&m)[Degree][Degree + 1], size_t size, long double (&a)[Degree]) {
+        for (size_t col = 0; col < size; ++col) {
+            auto pivot = col;
+            for (auto row = col + 1; row < size; ++row)
+                if (std::fabs(m[row][col]) > std::fabs(m[pivot][col]))
+                    pivot = row;
+            if (m[pivot][col] == 0)
+                return false;
+            for (size_t k = 0; k <= Degree; ++k)
+                std::swap(m[col][k], m[pivot][k]);
+            for (auto row = col + 1; row < size; ++row) {
+                auto f = m[row][col] / m[col][col];
+                for (auto k = col; k <= Degree; ++k)
+                    m[row][k] -= f * m[col][k];
+            }
+        }
+
+        for (auto row = size; row-- > 0;) {
+            auto sum = m[row][Degree];
+            for (auto k = row + 1; k < size; ++k)
+                sum -= m[row][k] * a[k];
+            a[row] = sum / m[row][row];
+        }
+        return true;
+    }
+
+    /** Returns the minimum of the derivative of the polynomial of @p s in [0, u_end]. */
+    static long double min_derivative(const segment_type &s, long double u_end) {
+        auto &c = s.coefficients;
+        auto derivative = [&](long double u) {
+            long double result = 0;
+            for (auto k = Degree; k >= 1; --k)
+                result = result * u + k * (long double) c[k - 1];
+            return result;
+        };
+
+        auto result = std::min(derivative(0), derivative(u_end));
+        if constexpr (Degree == 3) {
+            if (c[2] != 0) {
+                auto vertex = -(long double) c[1] / (3 * (long double) c[2]);
+                if (vertex > 0 && vertex < u_end)
+                    result = std::min(result, derivative(vertex));
+            }
+        }
+        return result;
+    }
+
+public:
+
+    /**
+     * @param points the points to fit, with strictly increasing keys
+     * @param epsilon the maximum error
+     * @param n the position of the keys greater than the key of the last point
+     */
+    PolynomialFitter(const std::vector<std::pair<X, size_t>> &points, size_t epsilon, size_t n)
+        : points(points), epsilon(epsilon), n(n) {}
+
+    /**
+     * Fits a polynomial of the given degree through the first of the points in [first, last).
+     * @param first, last the range of the points to fit
+     * @param degree the degree of the polynomial, less than last - first
+     * @param s the segment that receives the polynomial
+     * @return true if the polynomial satisfies the error bound
+     */
+    bool fit(size_t first, size_t last, size_t degree, segment_type &s) const {
+        degree = std::min(degree, Degree);
+        auto origin = points[first].first;
+        auto y0 = points[first].second;
+        auto bound = last < points.size() ? points[last].second : n;
+        auto span = (long double) segment_type::delta(points[last - 1].first, origin);
+
+        s.first_x = origin;
+        s.first = uint32_t(y0);
+        s.coefficients.fill(0);
+        if (degree > 0) {
+            // Least squares on keys rescaled to [0, 1] and positions relative to the first one, which the polynomial
+            // passes through, so it has no constant term
+            long double sums[2 * Degree + 1] = {};
+            long double m[Degree][Degree + 1] = {};
+            for (auto i = first + 1; i < last; ++i) {
+                auto t = segment_type::delta(points[i].first, origin) / span;
+                auto y = (long double) (points[i].second - y0);
+                long double power = t;
+                for (size_t k = 1; k <= 2 * degree; ++k, power *= t) {
+                    sums[k] += power;
+                    if (k <= degree)
+                        m[k - 1][Degree] += power * y;
+                }
+            }
+            for (size_t j = 1; j <= degree; ++j)
+                for (size_t k = 1; k <= degree; ++k)
+                    m[j - 1][k - 1] = sums[j + k];
+
+            long double a[Degree] = {};
+            if (!solve(m, degree, a))
+                return false;
+
+            auto u_span = span * segment_type::scale;
+            long double power = u_span;
+            for (size_t k = 1; k <= degree; ++k, power *= u_span)
+                s.coefficients[k - 1] = float(a[k - 1] / power);
+            for (auto c : s.coefficients)
+                if (!std::isfinite(c))
+                    return false;
+        }
+
+        for (auto i = first; i < last; ++i) {
+            auto pos = s.position(points[i].first, bound);
+            auto y = points[i].second;
+            if ((pos > y ? pos - y : y - pos) > epsilon)
+                return false;
+        }
+
+        auto x_end = last < points.size() ? points[last].first : points[last - 1].first;
+        return degree == 0 || min_derivative(s, segment_type::delta(x_end, origin) * segment_type::scale) >= 0;
+    }
+
+    /**
+     * Fits a polynomial to the points in [first, last), trying the degrees from the highest to 1. A few points may be
+     * fitted by a line but not by a polynomial of higher degree that is non-decreasing.
+     * @param first, last the range of the points to fit
+     * @param s the segment that receives the polynomial
+     * @return true if a polynomial satisfies the error bound
+     */
+    bool fit(size_t first, size_t last, segment_type &s) const {
+        auto max_degree = std::min(Degree, last - first - 1);
+        for (auto degree = max_degree; degree >= 1; --degree)
+            if (fit(first, last, degree, s))
+                return true;
+        return max_degree == 0 && fit(first, last, 0, s);
+    }
+};
+
+/**
+ * Computes a piecewise polynomial model of the points in(0), ..., in(n - 1), which must have non-decreasing keys, with
+ * polynomials of degree at most @p Degree that predict the position of each point within @p epsilon. Of the points
+ * with equal keys, only the first is considered.
+ *
+ * The segmentation is greedy: each segment is extended as much as an exponential search followed by a binary search
+ * on the number of points finds a polynomial that fits them, so it takes O(n log(n)) time.
+ *
+ * @tparam Degree the maximum degree of the polynomials, from 1 to 3
+ * @param n the number of points
+ * @param epsilon the maximum error
+ * @param in a function that returns the ith point as a pair (key, position)
+ * @param out a function called on each segment, in order
+ * @return the number of segments
+ */
+template<size_t Degree, typename Fin, typename Fout>
+size_t make_polynomial_segmentation(size_t n, size_t epsilon, Fin in, Fout out) {
+    if (n == 0)
+        return 0;
+
+    using X = typename std::invoke_result_t<Fin, size_t>::first_type;
+    std::vector<std::pair<X, size_t>> points;
+    points.reserve(n);
+    points.emplace_back(in(0));
+    for (size_t i = 1; i < n; ++i) {
+        auto p = in(i);
+        if (p.first != points.back().first)
+            points.emplace_back(p);
+    }
+
+    PolynomialFitter<X, Degree> fitter(points, epsilon, n);
+    PolynomialSegment<X, Degree> best;
+    PolynomialSegment<X, Degree> candidate;
+    size_t c = 0;
+    for (size_t first = 0; first < points.size(); ++c) {
+        auto remaining = points.size() - first;
+        fitter.fit(first, first + 1, best);
+        size_t good = 1;
+        size_t bad = 0;
+        for (auto len = std::min(Degree + 1, remaining); bad == 0 && good < remaining;
+             len = std::min(2 * len, remaining)) {
+            if (fitter.fit(first, first + len, candidate)) {
+                best = candidate;
+                good = len;
+            } else {
+                bad = len;
+            }
+        }
+
+        while (bad > good + 1) {
+            auto mid = good + (bad - good) / 2;
+            if (fitter.fit(first, first + mid, candidate)) {
+                best = candidate;
+                good = mid;
+            } else {
+                bad = mid;
+            }
+        }
+
+        out(best);
+        first += good;
+    }
+
+    return c;
+}
+
+}
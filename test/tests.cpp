@@ -18,20 +18,27 @@
 #include "pgm/pgm_index.hpp"
 #include "pgm/pgm_index_dynamic.hpp"
 #include "pgm/pgm_index_variants.hpp"
+#include "pgm/pgm_table.hpp"
 #include "pgm/piecewise_linear_model.hpp"
 #include "utils.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <cmath>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <iterator>
 #include <limits>
+#include <list>
 #include <map>
 #include <random>
 #include <string>
+#include <thread>
 #include <tuple>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -46,6 +53,7 @@ void test_index(const Index &index, const Data &data) {
         auto hi = data.begin() + range.hi;
         auto k = std::lower_bound(lo, hi, q);
         REQUIRE(*k == q);
+        REQUIRE(pgm::lower_bound_in<Index::epsilon_value>(data.begin(), range, q) == k);
     }
 
     // Test elements outside range
@@ -83,6 +91,131 @@ TEMPLATE_TEST_CASE("Segmentation algorithm", "", float, double, uint32_t, uint64
     }
 }
 
+TEST_CASE("Segmentation algorithm on keys with growing gaps", "") {
+    // The segments span from small to huge key ranges, so the hull arithmetic switches from 64 to 128 bits
+    auto epsilon = GENERATE(4, 64);
+    std::vector<uint64_t> data;
+    std::mt19937_64 gen(42);
+    uint64_t key = 0;
+    for (auto shift = 4; shift <= 40; shift += 4)
+        for (auto i = 0; i < 20000; ++i)
+            data.push_back(key += 1 + (gen() >> (64 - shift)));
+
+    auto segments = pgm::internal::make_segmentation(data.begin(), data.end(), epsilon);
+    auto it = segments.begin();
+    auto [slope, intercept] = it->get_floating_point_segment(it->get_first_x());
+    for (auto i = 0u; i < data.size(); ++i) {
+        if (std::next(it) != segments.end() && std::next(it)->get_first_x() <= data[i]) {
+            ++it;
+            std::tie(slope, intercept) = it->get_floating_point_segment(it->get_first_x());
+        }
+        auto pos = (data[i] - it->get_first_x()) * slope + intercept;
+        REQUIRE(std::fabs(i - pos) <= epsilon + 1);
+    }
+}
+
+TEST_CASE("Segmentation algorithm on keys around 2^63", "") {
+    // The keys straddle 2^63, so their differences must not be computed as differences of int64_t
+    auto epsilon = GENERATE(32, 128);
+    auto data = generate_data<uint64_t>(1000000);
+    auto expected = pgm::internal::make_segmentation(data.begin(), data.end(), epsilon);
+    auto offset = (uint64_t(1) << 63) - data[data.size() / 2];
+    for (auto &x : data)
+        x += offset;
+
+    auto segments = pgm::internal::make_segmentation(data.begin(), data.end(), epsilon);
+    REQUIRE(segments.size() == expected.size());
+    auto it = segments.begin();
+    auto [slope, intercept] = it->get_floating_point_segment(it->get_first_x());
+    for (auto i = 0u; i < data.size(); ++i) {
+        if (i != 0 && data[i] == data[i - 1])
+            continue;
+        if (std::next(it) != segments.end() && std::next(it)->get_first_x() <= data[i]) {
+            ++it;
+            std::tie(slope, intercept) = it->get_floating_point_segment(it->get_first_x());
+        }
+        auto pos = (data[i] - it->get_first_x()) * slope + intercept;
+        REQUIRE(std::fabs(i - pos) <= epsilon + 1);
+    }
+}
+
+TEMPLATE_TEST_CASE("Shrinking-cone segmentation algorithm", "", float, double, uint32_t, uint64_t) {
+    auto epsilon = GENERATE(32, 64, 128);
+    auto data = generate_data<TestType>(1000000);
+    auto segments = pgm::internal::make_segmentation<pgm::ShrinkingConeSegmentation>(data.begin(), data.end(), epsilon);
+    auto optimal = pgm::internal::make_segmentation(data.begin(), data.end(), epsilon);
+    REQUIRE(segments.size() >= optimal.size());
+
+    auto it = segments.begin();
+    auto [slope, intercept] = it->get_floating_point_segment(it->get_first_x());
+
+    for (auto i = 0u; i < data.size(); ++i) {
+        if (i != 0 && data[i] == data[i - 1])
+            continue;
+        if (std::next(it) != segments.end() && std::next(it)->get_first_x() <= data[i]) {
+            ++it;
+            std::tie(slope, intercept) = it->get_floating_point_segment(it->get_first_x());
+        }
+
+        auto pos = (data[i] - it->get_first_x()) * slope + intercept;
+        auto e = std::fabs(i - pos);
+        REQUIRE(e <= epsilon + 1);
+    }
+
+    using canonical_segment = typename decltype(segments)::value_type;
+    std::vector<canonical_segment> segments_par;
+    auto in_fun = [&](auto i) { return std::pair<TestType, size_t>(data[i], i); };
+    pgm::internal::make_segmentation_par_into<canonical_segment, pgm::ShrinkingConeSegmentation>(
+        data.size(), epsilon, in_fun, segments_par, 7);
+    REQUIRE(segments_par.size() == segments.size());
+    for (size_t i = 0; i < segments.size(); ++i)
+        REQUIRE(segments_par[i].get_first_x() == segments[i].get_first_x());
+}
+
+TEMPLATE_TEST_CASE("Parallel segmentation algorithm", "", float, uint32_t, uint64_t) {
+    auto epsilon = GENERATE(8, 128);
+    auto parallelism = GENERATE(2, 7, 64, 1000);
+    auto data = generate_data<TestType>(200000);
+    auto in_fun = [&](auto i) { return std::pair<TestType, size_t>(data[i], i); };
+
+    using canonical_segment = typename pgm::internal::OptimalPiecewiseLinearModel<TestType, size_t>::CanonicalSegment;
+    std::vector<canonical_segment> expected, segments, segments_into;
+    auto expected_count = pgm::internal::make_segmentation(data.size(), epsilon, in_fun, [&](const auto &cs) {
+        expected.push_back(cs);
+    });
+    auto count = pgm::internal::make_segmentation_par(data.size(), epsilon, in_fun, [&](const auto &cs) {
+        segments.push_back(cs);
+    }, parallelism);
+    auto count_into = pgm::internal::make_segmentation_par_into(data.size(), epsilon, in_fun, segments_into,
+                                                                parallelism);
+
+    REQUIRE(count == expected_count);
+    REQUIRE(count_into == expected_count);
+    REQUIRE(segments.size() == expected.size());
+    REQUIRE(segments_into.size() == expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        auto origin = expected[i].get_first_x();
+        REQUIRE(segments[i].get_first_x() == origin);
+        REQUIRE(segments_into[i].get_first_x() == origin);
+        REQUIRE(segments[i].get_floating_point_segment(origin) == expected[i].get_floating_point_segment(origin));
+    }
+}
+
+TEMPLATE_TEST_CASE("Last-mile search", "", float, double, int32_t, uint32_t, int64_t, uint64_t) {
+    auto data = generate_data<TestType>(100000);
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 1), std::mt19937{42});
+
+    for (auto i = 1; i <= 10000; ++i) {
+        auto lo = rand();
+        auto hi = std::min(data.size(), lo + rand() % 600);
+        auto q = i % 2 ? data[rand()] : data[lo] + TestType(i % 7);
+        pgm::ApproxPos range{lo, lo, hi};
+        auto expected = std::lower_bound(data.begin() + lo, data.begin() + hi, q);
+        REQUIRE(pgm::lower_bound_in(data.begin(), range, q) == expected);
+        REQUIRE(pgm::lower_bound_in<16>(data.data(), range, q) == &*data.begin() + (expected - data.begin()));
+    }
+}
+
 TEMPLATE_TEST_CASE_SIG("PGM-index", "",
                        ((typename T, size_t E1, size_t E2), T, E1, E2),
                        (uint32_t, 8, 0), (uint32_t, 32, 0), (uint32_t, 128, 0),
@@ -93,6 +226,395 @@ TEMPLATE_TEST_CASE_SIG("PGM-index", "",
     test_index(index, data);
 }
 
+TEMPLATE_TEST_CASE_SIG("PGM-index with shrinking-cone segmentation", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 8, 0), (uint32_t, 64, 4), (uint64_t, 32, 4), (uint64_t, 128, 16)) {
+    auto data = generate_data<T>(2000000);
+    pgm::PGMIndex<T, E1, E2, float, int32_t, pgm::ShrinkingConeSegmentation> index(data.begin(), data.end());
+    test_index(index, data);
+
+    std::list<T> list(data.begin(), data.end());
+    pgm::PGMIndex<T, E1, E2, float, int32_t, pgm::ShrinkingConeSegmentation> streamed(list.begin(), list.end());
+    REQUIRE(streamed.segments_count() == index.segments_count());
+    test_index(streamed, data);
+}
+
+TEMPLATE_TEST_CASE_SIG("PGM-index tight search ranges", "",
+                       ((typename T, size_t E1, size_t E2, typename S), T, E1, E2, S),
+                       (uint32_t, 8, 0, pgm::OptimalSegmentation), (uint64_t, 64, 4, pgm::OptimalSegmentation),
+                       (int64_t, 32, 4, pgm::ShrinkingConeSegmentation), (double, 128, 8, pgm::OptimalSegmentation)) {
+    auto data = generate_data<T>(1000000);
+    pgm::PGMIndex<T, E1, E2, float, int32_t, S> index(data.begin(), data.end());
+
+    size_t total_width = 0;
+    for (size_t i = 0; i < data.size(); i += 3) {
+        for (auto q : {data[i], T(data[i] + 1), T(data[i] - 1)}) {
+            if (q == std::numeric_limits<T>::max())
+                continue;
+            auto range = index.search(q);
+            auto expected = std::lower_bound(data.begin(), data.end(), q);
+            REQUIRE(range.lo <= range.hi);
+            REQUIRE(range.hi <= data.size());
+            REQUIRE(range.lo + E1 >= range.pos);
+            REQUIRE(range.hi - range.lo <= 2 * E1 + 2);
+            REQUIRE(std::lower_bound(data.begin() + range.lo, data.begin() + range.hi, q) == expected);
+            total_width += range.hi - range.lo;
+        }
+    }
+    REQUIRE(total_width < (data.size() / 3) * 3 * (2 * E1 + 2));
+}
+
+TEMPLATE_TEST_CASE_SIG("PGM-index sorted search", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 8, 0), (uint64_t, 32, 4), (uint64_t, 128, 16)) {
+    auto data = generate_data<T>(1000000);
+    pgm::PGMIndex<T, E1, E2> index(data.begin(), data.end());
+
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 1), std::mt19937{42});
+    for (auto stride : {1, 100, 100000}) {
+        std::vector<T> queries;
+        for (size_t i = rand() % stride; i < data.size(); i += 1 + rand() % stride)
+            queries.push_back(i % 3 ? data[i] : T(data[i] + 1));
+        std::sort(queries.begin(), queries.end());
+
+        std::vector<pgm::ApproxPos> out(queries.size());
+        REQUIRE(index.search_sorted(queries.begin(), queries.end(), out.begin()) == out.end());
+        for (size_t i = 0; i < queries.size(); ++i) {
+            auto expected = index.search(queries[i]);
+            REQUIRE(out[i].pos == expected.pos);
+            REQUIRE(out[i].lo == expected.lo);
+            REQUIRE(out[i].hi == expected.hi);
+        }
+    }
+
+    auto cursor = index.cursor();
+    for (auto i = 1; i <= 10000; ++i) {
+        auto q = data[rand()];
+        auto range = cursor.search(q);
+        auto expected = index.search(q);
+        REQUIRE(range.pos == expected.pos);
+        REQUIRE(range.lo == expected.lo);
+        REQUIRE(range.hi == expected.hi);
+    }
+}
+
+TEMPLATE_TEST_CASE_SIG("Dynamic-epsilon PGM-index", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 32, 0), (uint32_t, 100, 3), (uint64_t, 64, 4), (uint64_t, 16, 256),
+                       (uint64_t, 300, 50)) {
+    auto data = generate_data<T>(1000000);
+    pgm::PGMIndex<T, E1, E2> expected(data.begin(), data.end());
+    pgm::DynamicEpsilonPGMIndex<T> index(data, E1, E2);
+    REQUIRE(index.segments_count() == expected.segments_count());
+    REQUIRE(index.height() == expected.height());
+    REQUIRE_THROWS_AS(pgm::DynamicEpsilonPGMIndex<T>(data, 0), std::invalid_argument);
+
+    pgm::DynamicEpsilonPGMIndex<T> empty;
+    auto empty_copy = empty;
+    REQUIRE(empty_copy.size() == 0);
+    REQUIRE(empty_copy.search(data[0]).hi == 0);
+
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 1), std::mt19937{42});
+    for (auto i = 1; i <= 10000; ++i) {
+        auto q = i % 2 ? data[rand()] : T(data[rand()] + 1);
+        auto range = index.search(q);
+        auto expected_range = expected.search(q);
+        REQUIRE(range.pos == expected_range.pos);
+        REQUIRE(range.lo <= expected_range.lo);
+        REQUIRE(range.hi >= expected_range.hi);
+        REQUIRE(index.lower_bound_in(data.begin(), q) == std::lower_bound(data.begin(), data.end(), q));
+    }
+}
+
+TEMPLATE_TEST_CASE_SIG("PGM-index instrumentation", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 32, 4), (uint64_t, 64, 0), (int64_t, 16, 128)) {
+    auto data = generate_data<T>(1000000);
+    pgm::PGMIndex<T, E1, E2> expected(data.begin(), data.end());
+    pgm::PGMIndex<T, E1, E2, float, int32_t, pgm::OptimalSegmentation, pgm::CountingInstrumentation> index(data);
+    pgm::DynamicEpsilonPGMIndex<T, float, int32_t, pgm::CountingInstrumentation> dynamic_index(data, E1, E2);
+    auto &counters = pgm::CountingInstrumentation::counters();
+    size_t levels = E2 == 0 ? 1 : index.height() - 1;
+
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 1), std::mt19937{42});
+    for (auto i = 1; i <= 10000; ++i) {
+        auto q = i % 2 ? data[rand()] : T(data[rand()] + 1);
+        auto before = counters;
+        auto range = index.search(q);
+        auto events = counters - before;
+        auto expected_range = expected.search(q);
+        REQUIRE(range.pos == expected_range.pos);
+        REQUIRE(range.lo == expected_range.lo);
+        REQUIRE(range.hi == expected_range.hi);
+        REQUIRE(events.searches == 1);
+        REQUIRE(events.levels == levels);
+        if constexpr (E2 == 0)
+            REQUIRE(events.segments_scanned == size_t(std::ceil(std::log2(index.segments_count() + 1.))));
+        else
+            REQUIRE(events.segments_scanned >= levels);
+        REQUIRE(events.window == range.hi - range.lo);
+        REQUIRE(events.clipped <= levels + 1);
+
+        before = counters;
+        range = dynamic_index.search(q);
+        events = counters - before;
+        REQUIRE(events.searches == 1);
+        REQUIRE(events.levels == levels);
+        if constexpr (E2 == 0)
+            REQUIRE(events.segments_scanned == size_t(std::ceil(std::log2(dynamic_index.segments_count() + 1.))));
+        REQUIRE(events.window == range.hi - range.lo);
+    }
+
+    auto before = counters;
+    std::vector<pgm::ApproxPos> ranges;
+    index.search_batch(data, ranges);
+    REQUIRE((counters - before).searches == data.size());
+
+    before = counters;
+    index.search_sorted(data.begin(), data.end(), ranges.begin());
+    auto events = counters - before;
+    size_t window = 0;
+    for (auto &r : ranges)
+        window += r.hi - r.lo;
+    REQUIRE(events.searches == data.size());
+    REQUIRE(events.levels >= data.size());
+    REQUIRE(events.segments_scanned >= index.segments_count());
+    REQUIRE(events.window == window);
+}
+
+template<typename Index, typename Expected, typename Data>
+void test_instrumentation(const Index &index, const Expected &expected, const Data &data, size_t levels) {
+    using T = typename Data::value_type;
+    auto &counters = pgm::CountingInstrumentation::counters();
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 2), std::mt19937{42});
+    size_t segments_scanned = 0;
+    for (auto i = 1; i <= 10000; ++i) {
+        auto q = i % 2 ? data[rand()] : T(data[rand()] + 1);
+        auto before = counters;
+        auto range = index.search(q);
+        auto events = counters - before;
+        auto expected_range = expected.search(q);
+        REQUIRE(range.pos == expected_range.pos);
+        REQUIRE(range.lo == expected_range.lo);
+        REQUIRE(range.hi == expected_range.hi);
+        REQUIRE(events.searches == 1);
+        REQUIRE(events.levels == levels);
+        REQUIRE(events.window == range.hi - range.lo);
+        REQUIRE(events.clipped <= levels + 1);
+        segments_scanned += events.segments_scanned;
+    }
+    REQUIRE(segments_scanned >= 10000 * levels);
+}
+
+TEMPLATE_TEST_CASE_SIG("PGM-index variants instrumentation", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 32, 4), (uint64_t, 64, 0), (int64_t, 16, 128)) {
+    using Counting = pgm::CountingInstrumentation;
+    auto data = generate_data<T>(1000000);
+    data.erase(std::unique(data.begin(), data.end()), data.end());
+    auto single_level = [](size_t height) { return E2 == 0 ? 1 : height - 1; };
+
+    pgm::SoAPGMIndex<T, E1, E2> soa(data.begin(), data.end());
+    pgm::SoAPGMIndex<T, E1, E2, float, int32_t, Counting> counting_soa(data.begin(), data.end());
+    test_instrumentation(counting_soa, soa, data, single_level(soa.height()));
+
+    if constexpr (E2 != 0) {
+        pgm::CacheAlignedPGMIndex<T, E1, E2> aligned(data.begin(), data.end());
+        pgm::CacheAlignedPGMIndex<T, E1, E2, float, int32_t, Counting> counting_aligned(data.begin(), data.end());
+        test_instrumentation(counting_aligned, aligned, data, aligned.height() - 1);
+    }
+
+    pgm::AppendablePGMIndex<T, E1, E2> appendable(data.begin(), data.end());
+    pgm::AppendablePGMIndex<T, E1, E2, float, int32_t, Counting> counting_appendable(data.begin(), data.end());
+    test_instrumentation(counting_appendable, appendable, data, appendable.height());
+
+    pgm::PolynomialPGMIndex<T, 2, E1, E2> polynomial(data.begin(), data.end());
+    pgm::PolynomialPGMIndex<T, 2, E1, E2, Counting> counting_polynomial(data.begin(), data.end());
+    test_instrumentation(counting_polynomial, polynomial, data, single_level(polynomial.height()));
+
+    std::vector<T> queries(data.begin(), data.begin() + data.size() / 10);
+    pgm::WorkloadAwarePGMIndex<T, E2> workload_aware(data, queries, E1);
+    pgm::WorkloadAwarePGMIndex<T, E2, float, int32_t, Counting> counting_workload_aware(data, queries, E1);
+    test_instrumentation(counting_workload_aware, workload_aware, data, single_level(workload_aware.height()));
+
+    pgm::CompressedPGMIndex<T, E1, E2> compressed(data);
+    pgm::CompressedPGMIndex<T, E1, E2, float, Counting> counting_compressed(data);
+    test_instrumentation(counting_compressed, compressed, data, counting_compressed.height() - 1);
+
+    pgm::BucketingPGMIndex<T, E1, 256> bucketing(data.begin(), data.end());
+    pgm::BucketingPGMIndex<T, E1, 256, 32, float, Counting> counting_bucketing(data.begin(), data.end());
+    test_instrumentation(counting_bucketing, bucketing, data, 1);
+
+    pgm::EliasFanoPGMIndex<T, E1> elias_fano(data.begin(), data.end());
+    pgm::EliasFanoPGMIndex<T, E1, float, Counting> counting_elias_fano(data.begin(), data.end());
+    test_instrumentation(counting_elias_fano, elias_fano, data, 1);
+
+    // A run-length index counts the searches of the index on its distinct keys
+    pgm::RunLengthPGMIndex<T, E1, E2, float, Counting> counting_run_length(data);
+    auto before = Counting::counters();
+    REQUIRE(counting_run_length.count(data[data.size() / 2]) == 1);
+    auto events = Counting::counters() - before;
+    REQUIRE(events.searches == 1);
+    REQUIRE(events.levels == single_level(pgm::PGMIndex<T, E1, E2>(data.begin(), data.end()).height()));
+}
+
+TEMPLATE_TEST_CASE_SIG("PGM-index with custom slope and intercept types", "",
+                       ((typename T, size_t E1, size_t E2, typename F, typename I), T, E1, E2, F, I),
+                       (uint32_t, 32, 4, float, int64_t), (uint64_t, 64, 4, double, int64_t),
+                       (uint32_t, 16, 0, pgm::FixedPoint, int32_t), (uint64_t, 64, 4, pgm::FixedPoint, int32_t),
+                       (int64_t, 128, 8, pgm::FixedPoint, int64_t)) {
+    auto data = generate_data<T>(2000000);
+    pgm::PGMIndex<T, E1, E2, F, I> index(data.begin(), data.end());
+    test_index(index, data);
+
+    using SmallIndex = pgm::PGMIndex<T, E1, E2, F, int16_t>;
+    REQUIRE_THROWS_AS(SmallIndex(data.begin(), data.end()), std::overflow_error);
+}
+
+TEST_CASE("Fixed-point slopes", "") {
+    for (long double slope : {0.L, 1e-15L, 0.001L, 0.5L, 1.L, 3.14159L, 12345.678L}) {
+        pgm::FixedPoint f(slope);
+        REQUIRE(std::fabs((long double) f - slope) <= slope * 1e-18L);
+        for (uint64_t dx : {uint64_t(0), uint64_t(1), uint64_t(1000), uint64_t(1) << 31, uint64_t(1) << 40})
+            REQUIRE(std::abs(f * dx - int64_t(slope * dx)) <= 1);
+    }
+    REQUIRE(pgm::FixedPoint(1e-30L) == pgm::FixedPoint(0));
+}
+
+TEMPLATE_TEST_CASE_SIG("PGM-index construction with a workspace", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 8, 0), (uint64_t, 32, 4), (int64_t, 128, 8)) {
+    pgm::SegmentationWorkspace<T> workspace;
+    size_t workspace_bytes = 0;
+    for (auto scale : {1, 2, 3}) {
+        auto data = generate_data<T>(200000 * scale);
+        pgm::PGMIndex<T, E1, E2> expected(data.begin(), data.end());
+        pgm::PGMIndex<T, E1, E2> index(data.begin(), data.end(), workspace);
+        REQUIRE(index.segments_count() == expected.segments_count());
+        REQUIRE(workspace.size_in_bytes() >= workspace_bytes);
+        workspace_bytes = workspace.size_in_bytes();
+        test_index(index, data);
+
+        std::list<T> list(data.begin(), data.end());
+        pgm::PGMIndex<T, E1, E2> list_index(list.begin(), list.end(), workspace);
+        REQUIRE(list_index.segments_count() == expected.segments_count());
+    }
+
+    auto data = generate_data<T>(200000);
+    pgm::PGMIndex<T, E1, E2> index(data.begin(), data.end(), workspace);
+    REQUIRE(workspace.size_in_bytes() == workspace_bytes);
+}
+
+TEMPLATE_TEST_CASE_SIG("PGM-index streaming construction", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 8, 0), (uint64_t, 32, 4), (int64_t, 128, 8)) {
+    std::string tmp_filename = "tmp.keys.bin";
+    auto data = generate_data<T>(1000000);
+    {
+        std::ofstream out(tmp_filename, std::ios::binary);
+        out.write((const char *) data.data(), data.size() * sizeof(T));
+    }
+
+    pgm::BinaryFileReader<T> reader(tmp_filename, 1000);
+    REQUIRE(reader.size() == data.size());
+    pgm::PGMIndex<T, E1, E2> index(reader.begin(), reader.end());
+    test_index(index, data);
+
+    std::list<T> list(data.begin(), data.end());
+    pgm::PGMIndex<T, E1, E2> list_index(list.begin(), list.end());
+    test_index(list_index, data);
+
+    pgm::MappedPGMIndex<T, E1, E2> mapped(tmp_filename, tmp_filename + ".mapped");
+    REQUIRE(std::equal(mapped.begin(), mapped.end(), data.begin(), data.end()));
+    test_index(mapped, data);
+
+    // The max() key alone is the sentinel, so it leaves no key to segment
+    std::vector<T> max_only = {std::numeric_limits<T>::max()};
+    std::list<T> max_only_list(max_only.begin(), max_only.end());
+    pgm::PGMIndex<T, E1, E2> max_index(max_only.begin(), max_only.end());
+    pgm::PGMIndex<T, E1, E2> max_list_index(max_only_list.begin(), max_only_list.end());
+    REQUIRE(max_index.segments_count() == 0);
+    REQUIRE(max_list_index.segments_count() == 0);
+
+    std::remove(tmp_filename.c_str());
+    std::remove((tmp_filename + ".mapped").c_str());
+}
+
+TEMPLATE_TEST_CASE_SIG("PGM-index save and open_mapped", "",
+                       ((typename T, size_t E1, size_t E2, typename F), T, E1, E2, F),
+                       (uint32_t, 32, 0, float), (uint64_t, 64, 4, double), (int64_t, 16, 4, pgm::FixedPoint)) {
+    std::string tmp_filename = "tmp.saved.pgm";
+    auto data = generate_data<T>(1000000);
+    pgm::PGMIndex<T, E1, E2, F> index(data.begin(), data.end());
+    index.save(tmp_filename);
+
+    auto mapped = pgm::PGMIndex<T, E1, E2, F>::open_mapped(tmp_filename);
+    REQUIRE(mapped.segments_count() == index.segments_count());
+    REQUIRE(mapped.height() == index.height());
+    REQUIRE(mapped.size_in_bytes() == index.size_in_bytes());
+
+    auto copy = mapped;
+    mapped = pgm::PGMIndex<T, E1, E2, F>();
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 1), std::mt19937{42});
+    for (auto i = 1; i <= 10000; ++i) {
+        auto q = data[rand()];
+        auto range = copy.search(q);
+        auto expected = index.search(q);
+        REQUIRE(range.pos == expected.pos);
+        REQUIRE(range.lo == expected.lo);
+        REQUIRE(range.hi == expected.hi);
+    }
+
+    REQUIRE_THROWS_AS((pgm::PGMIndex<T, E1 + 1, E2, F>::open_mapped(tmp_filename)), std::runtime_error);
+    REQUIRE_THROWS_AS((pgm::PGMIndex<T, E1, E2, F>::open_mapped("tmp.missing.pgm")), std::runtime_error);
+
+    // Equal indexes are written to equal files
+    auto read_file = [](const std::string &path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+    auto bytes = read_file(tmp_filename);
+    pgm::PGMIndex<T, E1, E2, F>(data.begin(), data.end()).save(tmp_filename);
+    REQUIRE(read_file(tmp_filename) == bytes);
+
+    // Damaged files are rejected, with the fields of the header and the level offsets at these positions
+    const size_t levels_count = 48, segments_count = 64, errors_count = 80, level_offsets = 128;
+    for (auto [position, value] : {std::pair<size_t, uint64_t>{levels_count, 1},
+                                   {levels_count, 0},
+                                   {segments_count, uint64_t(1) << 61},
+                                   {errors_count, 1},
+                                   {level_offsets + sizeof(size_t), uint64_t(1) << 40}}) {
+        auto damaged = bytes;
+        std::memcpy(&damaged[position], &value, sizeof(value));
+        std::ofstream(tmp_filename, std::ios::binary).write(damaged.data(), damaged.size());
+        REQUIRE_THROWS_AS((pgm::PGMIndex<T, E1, E2, F>::open_mapped(tmp_filename)), std::runtime_error);
+    }
+    std::remove(tmp_filename.c_str());
+}
+
+TEMPLATE_TEST_CASE_SIG("PGM-index batch search", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 32, 0), (uint64_t, 32, 4), (uint64_t, 128, 256)) {
+    auto data = generate_data<T>(1000000);
+    pgm::PGMIndex<T, E1, E2> index(data.begin(), data.end());
+
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 1), std::mt19937{42});
+    std::vector<T> queries(10000);
+    std::generate(queries.begin(), queries.end(), [&] { return data[rand()]; });
+    queries.push_back(data.back() + 42);
+    queries.push_back(std::numeric_limits<T>::min());
+
+    std::vector<pgm::ApproxPos> results;
+    index.search_batch(queries, results);
+    REQUIRE(results.size() == queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        auto expected = index.search(queries[i]);
+        REQUIRE(results[i].pos == expected.pos);
+        REQUIRE(results[i].lo == expected.lo);
+        REQUIRE(results[i].hi == expected.hi);
+    }
+}
+
 TEMPLATE_TEST_CASE_SIG("Compressed PGM-index", "", ((size_t E), E), 8, 32, 128) {
     auto data = generate_data<uint32_t>(2000000);
     pgm::CompressedPGMIndex<uint32_t, E> index(data);
@@ -119,6 +641,175 @@ TEMPLATE_TEST_CASE_SIG("Elias-Fano PGM-index", "", ((size_t E), E), 8, 32, 128)
     test_index(index, data);
 }
 
+TEMPLATE_TEST_CASE_SIG("SoA PGM-index", "",
+                       ((typename T, size_t E1, size_t E2, typename I), T, E1, E2, I),
+                       (uint32_t, 8, 0, int32_t), (uint32_t, 32, 4, int64_t), (uint64_t, 64, 4, int32_t),
+                       (uint64_t, 128, 16, int64_t)) {
+    auto data = generate_data<T>(2000000);
+    pgm::SoAPGMIndex<T, E1, E2, float, I> index(data.begin(), data.end());
+    test_index(index, data);
+
+    using SmallIndex = pgm::SoAPGMIndex<T, E1, E2, float, int16_t>;
+    REQUIRE_THROWS_AS(SmallIndex(data.begin(), data.end()), std::overflow_error);
+}
+
+TEMPLATE_TEST_CASE_SIG("Cache-aligned PGM-index", "",
+                       ((typename T, size_t E1, size_t E2, typename I), T, E1, E2, I),
+                       (uint32_t, 8, 1, int32_t), (uint32_t, 32, 4, int64_t), (uint64_t, 64, 4, int32_t),
+                       (uint64_t, 128, 16, int64_t)) {
+    auto data = generate_data<T>(2000000);
+    pgm::CacheAlignedPGMIndex<T, E1, E2, float, I> index(data.begin(), data.end());
+    test_index(index, data);
+
+    using SmallIndex = pgm::CacheAlignedPGMIndex<T, E1, E2, float, int16_t>;
+    REQUIRE_THROWS_AS(SmallIndex(data.begin(), data.end()), std::overflow_error);
+}
+
+TEMPLATE_TEST_CASE_SIG("Appendable PGM-index", "",
+                       ((typename T, size_t E1, size_t E2, typename I), T, E1, E2, I),
+                       (uint32_t, 8, 0, int32_t), (uint32_t, 32, 4, int64_t), (uint64_t, 64, 2, int32_t),
+                       (int64_t, 128, 16, int64_t)) {
+    auto data = generate_data<T>(1000000);
+    data.erase(std::unique(data.begin(), data.end()), data.end());
+    pgm::AppendablePGMIndex<T, E1, E2, float, I> index;
+    REQUIRE(index.search(42).hi == 0);
+
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 1), std::mt19937{42});
+    for (size_t prefix : {size_t(1), size_t(2), size_t(1000), size_t(12345), size_t(100000), data.size()}) {
+        prefix = std::min(prefix, data.size());
+        index.append(data.begin() + index.size(), data.begin() + prefix);
+        REQUIRE(index.size() == prefix);
+        for (auto i = 1; i <= 1000; ++i) {
+            auto q = data[rand() % prefix];
+            auto range = index.search(q);
+            REQUIRE(range.hi <= prefix);
+            REQUIRE(*std::lower_bound(data.begin() + range.lo, data.begin() + range.hi, q) == q);
+        }
+        auto range = index.search(data[prefix - 1] + 1);
+        REQUIRE(std::lower_bound(data.begin() + range.lo, data.begin() + range.hi, data[prefix - 1] + 1)
+                    == data.begin() + prefix);
+    }
+
+    pgm::PGMIndex<T, E1, E2> expected(data.begin(), data.end());
+    REQUIRE(index.segments_count() <= expected.segments_count() + 1);
+    REQUIRE_THROWS_AS(index.push_back(data.back()), std::invalid_argument);
+    test_index(index, data);
+
+    // Runs of 40000 keys separated by jumps, so a segment completes at a position that does not fit int16_t
+    pgm::AppendablePGMIndex<T, E1, E2, float, int16_t> small;
+    REQUIRE_THROWS_AS([&] {
+        for (T run = 0; run < 3; ++run)
+            for (T i = 0; i < 40000; ++i)
+                small.push_back(run * 100000000 + i);
+    }(), std::overflow_error);
+}
+
+TEMPLATE_TEST_CASE_SIG("Polynomial PGM-index", "",
+                       ((typename T, size_t D, size_t E1, size_t E2), T, D, E1, E2),
+                       (uint32_t, 1, 32, 4), (uint64_t, 2, 64, 4), (int64_t, 3, 16, 0), (double, 2, 32, 4)) {
+    auto data = generate_data<T>(1000000);
+    pgm::PolynomialPGMIndex<T, D, E1, E2> index(data.begin(), data.end());
+    test_index(index, data);
+
+    for (size_t i = 0; i < data.size(); i += 7) {
+        auto range = index.search(data[i]);
+        auto expected = std::lower_bound(data.begin(), data.end(), data[i]) - data.begin();
+        REQUIRE(range.lo <= size_t(expected));
+        REQUIRE(size_t(expected) < range.hi);
+        REQUIRE(range.hi - range.lo <= 2 * E1 + 4);
+    }
+}
+
+TEMPLATE_TEST_CASE_SIG("Polynomial PGM-index size on log-normal keys", "",
+                       ((size_t D, size_t E1), D, E1), (2, 128), (3, 128), (3, 256)) {
+    std::mt19937_64 engine(42);
+    std::lognormal_distribution<double> lognormal(0, GENERATE(0.5, 2.));
+    std::vector<uint64_t> data(1000000);
+    for (auto &x : data)
+        x = uint64_t(lognormal(engine) * 1e12);
+    std::sort(data.begin(), data.end());
+
+    pgm::PGMIndex<uint64_t, E1> linear(data.begin(), data.end());
+    pgm::PolynomialPGMIndex<uint64_t, D, E1> index(data.begin(), data.end());
+    test_index(index, data);
+    REQUIRE(index.segments_count() < linear.segments_count());
+    REQUIRE(index.size_in_bytes() < linear.size_in_bytes());
+}
+
+TEMPLATE_TEST_CASE_SIG("Workload-aware PGM-index", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 32, 4), (uint64_t, 64, 0), (int64_t, 128, 8), (double, 64, 4)) {
+    auto data = generate_data<T>(1000000);
+    auto hot = std::bind(std::uniform_int_distribution<size_t>(0, data.size() / 10), std::mt19937{42});
+    std::vector<T> queries(100000);
+    for (auto &q : queries)
+        q = data[hot()];
+
+    pgm::WorkloadAwarePGMIndex<T, E2> index(data, queries, E1);
+    pgm::PGMIndex<T, E1, E2> uniform(data.begin(), data.end());
+    REQUIRE(index.segments_count() <= uniform.segments_count());
+    REQUIRE(index.size_in_bytes() <= uniform.size_in_bytes());
+    REQUIRE(index.epsilon_for(queries[0]) <= E1);
+    REQUIRE_THROWS_AS(pgm::WorkloadAwarePGMIndex<T>(data, queries, 0), std::invalid_argument);
+
+    size_t width = 0;
+    for (auto q : queries) {
+        auto range = index.search(q);
+        REQUIRE(range.hi - range.lo <= 2 * index.epsilon_for(q) + 2);
+        width += range.hi - range.lo;
+    }
+    REQUIRE(width < queries.size() * (2 * E1 + 2));
+
+    for (size_t i = 0; i < data.size(); i += 7) {
+        for (auto q : {data[i], T(data[i] + 1)}) {
+            auto range = index.search(q);
+            auto expected = std::lower_bound(data.begin(), data.end(), q);
+            REQUIRE(std::lower_bound(data.begin() + range.lo, data.begin() + range.hi, q) == expected);
+        }
+    }
+
+    // max() is the last key, with and without other keys
+    auto with_max = data;
+    with_max.push_back(std::numeric_limits<T>::max());
+    for (auto keys : {with_max, std::vector<T>(1, std::numeric_limits<T>::max())}) {
+        pgm::WorkloadAwarePGMIndex<T, E2> max_index(keys, queries, E1);
+        for (size_t i = 0; i < keys.size(); i += 7) {
+            for (auto q : {keys[i], T(keys[i] + 1), keys.back()}) {
+                auto range = max_index.search(q);
+                auto expected = std::lower_bound(keys.begin(), keys.end(), q);
+                REQUIRE(std::lower_bound(keys.begin() + range.lo, keys.begin() + range.hi, q) == expected);
+            }
+        }
+    }
+}
+
+TEMPLATE_TEST_CASE_SIG("Run-length PGM-index", "",
+                       ((typename T, size_t E1, size_t E2), T, E1, E2),
+                       (uint32_t, 8, 4), (uint64_t, 64, 0), (int64_t, 32, 4), (double, 16, 4)) {
+    auto data = generate_data<T>(1000000);
+    pgm::RunLengthPGMIndex<T, E1, E2> index(data);
+    auto distinct = data;
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    REQUIRE(index.size() == data.size());
+    REQUIRE(index.distinct_count() == distinct.size());
+
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 1), std::mt19937{42});
+    for (auto i = 1; i <= 10000; ++i) {
+        auto q = i % 2 ? data[rand()] : T(data[rand()] + 1);
+        auto lb = std::lower_bound(data.begin(), data.end(), q) - data.begin();
+        auto ub = std::upper_bound(data.begin(), data.end(), q) - data.begin();
+        REQUIRE(index.lower_bound(q) == size_t(lb));
+        REQUIRE(index.upper_bound(q) == size_t(ub));
+        REQUIRE(index.equal_range(q) == std::pair<size_t, size_t>(lb, lb == ub ? lb : ub));
+        REQUIRE(index.count(q) == size_t(ub - lb));
+        REQUIRE(index.contains(q) == (lb != ub));
+    }
+
+    REQUIRE(index.lower_bound(std::numeric_limits<T>::lowest()) == 0);
+    REQUIRE(index.upper_bound(std::numeric_limits<T>::max()) == data.size());
+    REQUIRE(pgm::RunLengthPGMIndex<T, E1, E2>().count(data[0]) == 0);
+}
+
 TEMPLATE_TEST_CASE_SIG("Mapped PGM-index", "", ((size_t E), E), 8, 32, 128) {
     std::string tmp_filename = "tmp.mapped.pgm";
     auto data = generate_data<uint32_t>(500000);
@@ -146,6 +837,65 @@ TEMPLATE_TEST_CASE_SIG("Mapped PGM-index", "", ((size_t E), E), 8, 32, 128) {
     std::remove(tmp_filename.c_str());
 }
 
+TEMPLATE_TEST_CASE_SIG("PGM table", "", ((typename T, size_t E), T, E), (uint32_t, 16), (uint64_t, 64), (double, 32)) {
+    struct Record {
+        uint32_t id;
+        T key;
+        char payload[20];
+    };
+
+    auto data = generate_data<T>(500000);
+    std::vector<Record> records(data.size());
+    for (size_t i = 0; i < data.size(); ++i)
+        records[i] = {uint32_t(i), data[i], {}};
+    std::shuffle(records.begin(), records.end(), std::mt19937{42});
+
+    pgm::PGMTable<Record, T Record::*, E> table(records, &Record::key);
+    auto key_fn = [](const Record &r) { return r.key; };
+    pgm::PGMTable<Record, decltype(key_fn), E> lambda_table(records.begin(), records.end(), key_fn);
+    REQUIRE(table.size() == data.size());
+    REQUIRE(std::is_sorted(table.begin(), table.end(), [](auto &a, auto &b) { return a.key < b.key; }));
+
+    auto rand = std::bind(std::uniform_int_distribution<size_t>(0, data.size() - 1), std::mt19937{42});
+    for (auto i = 1; i <= 10000; ++i) {
+        auto q = i % 2 ? data[rand()] : T(data[rand()] + 1);
+        auto lb = std::lower_bound(data.begin(), data.end(), q) - data.begin();
+        auto ub = std::upper_bound(data.begin(), data.end(), q) - data.begin();
+        REQUIRE(table.lower_bound(q) - table.begin() == lb);
+        REQUIRE(table.upper_bound(q) - table.begin() == ub);
+        REQUIRE(lambda_table.lower_bound(q) - lambda_table.begin() == lb);
+        REQUIRE(table.count(q) == size_t(ub - lb));
+        REQUIRE(table.contains(q) == (lb != ub));
+        REQUIRE((table.find(q) == table.end()) == (lb == ub));
+
+        auto hi = T(q + 100);
+        auto [first, last] = table.range(q, hi);
+        REQUIRE(first - table.begin() == lb);
+        REQUIRE(last - table.begin() == std::upper_bound(data.begin(), data.end(), hi) - data.begin());
+    }
+
+    auto [first, last] = table.equal_range(data[42]);
+    REQUIRE(std::all_of(first, last, [&](auto &r) { return r.key == data[42]; }));
+    REQUIRE(last - first == std::count(data.begin(), data.end(), data[42]));
+
+    pgm::PGMTable<Record, T Record::*, E> empty(&Record::key);
+    REQUIRE(empty.lower_bound(data[0]) == empty.end());
+    REQUIRE(empty.upper_bound(data[0]) == empty.end());
+
+    // A pointer to a member must be passed, whereas a function object can be default-constructed
+    using MemberTable = pgm::PGMTable<Record, T Record::*, E>;
+    static_assert(!std::is_default_constructible_v<MemberTable>);
+    static_assert(!std::is_constructible_v<MemberTable, std::vector<Record>>);
+    static_assert(!std::is_constructible_v<MemberTable, decltype(records.begin()), decltype(records.begin())>);
+    static_assert(std::is_constructible_v<MemberTable, std::vector<Record>, T Record::*>);
+    struct KeyOf {
+        T operator()(const Record &r) const { return r.key; }
+    };
+    pgm::PGMTable<Record, KeyOf, E> functor_table(records.begin(), records.end());
+    REQUIRE(pgm::PGMTable<Record, KeyOf, E>().empty());
+    REQUIRE(functor_table.lower_bound(data[42]) - functor_table.begin() == table.lower_bound(data[42]) - table.begin());
+}
+
 TEMPLATE_TEST_CASE("Dynamic PGM-index", "", uint32_t*, uint32_t) {
     TestType time = 0;
     auto rand = std::bind(std::uniform_int_distribution<uint32_t>(0, 1000000000), std::mt19937{42});
@@ -223,6 +973,30 @@ TEMPLATE_TEST_CASE("Dynamic PGM-index", "", uint32_t*, uint32_t) {
         ++it;
     }
 
+    // Insert and erase sorted batches, which may fit in the buffer or need a new level
+    for (auto batch_size : {5, 20000, 300000}) {
+        std::vector<std::pair<uint32_t, TestType>> batch(batch_size);
+        std::generate(batch.begin(), batch.end(), gen);
+        std::stable_sort(batch.begin(), batch.end(), [](auto &a, auto &b) { return a.first < b.first; });
+        pgm.insert_batch(batch.begin(), batch.end());
+        for (auto[k, v] : batch)
+            map.insert_or_assign(k, v);
+
+        std::vector<uint32_t> keys;
+        for (size_t i = 0; i < batch.size(); i += 3)
+            keys.push_back(batch[i].first);
+        pgm.erase_batch(keys.begin(), keys.end());
+        for (auto k : keys)
+            map.erase(k);
+    }
+    REQUIRE(pgm.size() == map.size());
+    it = pgm.begin();
+    for (auto[k, v] : map) {
+        REQUIRE(it->first == k);
+        REQUIRE(it->second == v);
+        ++it;
+    }
+
     // Test range
     for (int i = 0; i < 10; ++i) {
         auto lo = rand();
@@ -234,7 +1008,157 @@ TEMPLATE_TEST_CASE("Dynamic PGM-index", "", uint32_t*, uint32_t) {
             REQUIRE(v == map_it->second);
             ++map_it;
         }
+        REQUIRE(map_it == map.upper_bound(hi));
     }
+
+    // Test for_each_in_range
+    for (int i = 0; i < 10; ++i) {
+        auto lo = rand();
+        auto hi = lo + rand() / 2;
+        auto map_it = map.lower_bound(lo);
+        size_t visited = 0;
+        pgm.for_each_in_range(lo, hi, [&](auto k, auto v) {
+            REQUIRE(k == map_it->first);
+            REQUIRE(v == map_it->second);
+            ++map_it;
+            return ++visited < 100;
+        });
+        REQUIRE(visited == std::min<size_t>(100, std::distance(map.lower_bound(lo), map.upper_bound(hi))));
+    }
+
+    // The maximum key in several levels is visited once, with its most recent value
+    auto max_key = std::numeric_limits<uint32_t>::max();
+    for (auto n : {1000, 100, 10, 0}) {
+        pgm.insert_or_assign(max_key, ++time);
+        map.insert_or_assign(max_key, time);
+        for (auto j = 0; j < n; ++j) {
+            auto[k, v] = gen();
+            pgm.insert_or_assign(k, v);
+            map.insert_or_assign(k, v);
+        }
+    }
+    size_t visited = 0;
+    auto map_it = map.begin();
+    pgm.for_each_in_range(0, max_key, [&](auto k, auto v) {
+        REQUIRE(k == map_it->first);
+        REQUIRE(v == map_it->second);
+        ++map_it;
+        ++visited;
+    });
+    REQUIRE(visited == map.size());
+    REQUIRE_THROWS_AS(pgm.for_each_in_range(1, 0, [](auto, auto) {}), std::invalid_argument);
+}
+
+TEST_CASE("Dynamic PGM-index compaction of the maximum key", "") {
+    // Exhausted levels rank as the maximum key in the merge, so its shadowed copies must still be dropped
+    auto rand = std::bind(std::uniform_int_distribution<uint32_t>(0, 99), std::mt19937{42});
+    auto max_key = std::numeric_limits<uint32_t>::max();
+    pgm::DynamicPGMIndex<uint32_t, uint32_t> pgm(uint8_t(2), uint8_t(1), uint8_t(0));
+    std::map<uint32_t, uint32_t> map;
+
+    for (uint32_t i = 0; i < 20000; ++i) {
+        auto r = rand();
+        auto k = r % 7 == 0 ? max_key : r;
+        if (rand() % 4 == 0) {
+            pgm.erase(k);
+            map.erase(k);
+        } else {
+            pgm.insert_or_assign(k, i);
+            map.insert_or_assign(k, i);
+        }
+
+        if (i % 100 == 0) {
+            auto it = pgm.find(max_key);
+            auto map_it = map.find(max_key);
+            REQUIRE((it == pgm.end()) == (map_it == map.end()));
+            if (map_it != map.end())
+                REQUIRE(it->second == map_it->second);
+            REQUIRE(pgm.range(0, max_key) == std::vector<std::pair<uint32_t, uint32_t>>(map.begin(), map.end()));
+        }
+    }
+}
+
+TEST_CASE("Concurrent dynamic PGM-index", "") {
+    auto rand = std::bind(std::uniform_int_distribution<uint32_t>(0, 500000000), std::mt19937{42});
+
+    // The bulk-loaded keys are even and never updated, the inserted keys are odd
+    std::vector<std::pair<uint32_t, uint32_t>> bulk(100000);
+    std::generate(bulk.begin(), bulk.end(), [&] { auto k = rand() * 2; return std::make_pair(k, k / 2); });
+    std::sort(bulk.begin(), bulk.end());
+    bulk.erase(std::unique(bulk.begin(), bulk.end()), bulk.end());
+
+    auto max_sealed_buffers = GENERATE(size_t(0), size_t(2));
+    pgm::ConcurrentDynamicPGMIndex<uint32_t, uint32_t> pgm(bulk.begin(), bulk.end(), GENERATE(2, 8), 0, 0,
+                                                            max_sealed_buffers);
+    std::map<uint32_t, uint32_t> map(bulk.begin(), bulk.end());
+
+    std::atomic<bool> done(false);
+    std::atomic<size_t> errors(0);
+    std::atomic<size_t> searches(0);
+    auto reader = [&](uint32_t seed) {
+        std::mt19937 gen(seed);
+        while (!done.load()) {
+            auto[k, v] = bulk[gen() % bulk.size()];
+            auto found = pgm.find(k);
+            auto lb = pgm.lower_bound(k);
+            errors += !found || *found != v || !lb || lb->first != k;
+            auto odd = uint32_t(gen() % 1000000) * 2 + 1;
+            found = pgm.find(odd);
+            errors += found && *found != odd + 1;
+            ++searches;
+        }
+    };
+
+    std::vector<std::thread> readers;
+    for (uint32_t i = 0; i < 2; ++i)
+        readers.emplace_back(reader, i);
+
+    for (uint32_t i = 0; i < 2000; ++i) {
+        auto k = uint32_t(rand() % 1000000) * 2 + 1;
+        pgm.insert_or_assign(k, k + 1);
+        map.insert_or_assign(k, k + 1);
+        if (i % 10 == 0) {
+            auto e = uint32_t(rand() % 1000000) * 2 + 1;
+            pgm.erase(e);
+            map.erase(e);
+        }
+    }
+
+    done = true;
+    for (auto &t : readers)
+        t.join();
+    REQUIRE(searches > 0);
+    REQUIRE(errors == 0);
+
+    // Check the final state against the map, before and after merging the sealed buffers
+    auto same_pairs = [](auto &a, auto &b) { return a.first == b.first && a.second == b.second; };
+    auto all = pgm.range(0, std::numeric_limits<uint32_t>::max());
+    REQUIRE(std::equal(all.begin(), all.end(), map.begin(), map.end(), same_pairs));
+    pgm.wait_for_compaction();
+    all = pgm.range(0, std::numeric_limits<uint32_t>::max());
+    REQUIRE(std::equal(all.begin(), all.end(), map.begin(), map.end(), same_pairs));
+    REQUIRE(pgm.size() == map.size());
+
+    for (int i = 0; i < 1000; ++i) {
+        auto q = rand() * 2 + 1;
+        auto found = pgm.find(q);
+        auto lb = pgm.lower_bound(q);
+        auto map_it = map.lower_bound(q);
+        REQUIRE(found.has_value() == map.count(q));
+        REQUIRE(lb.has_value() == (map_it != map.end()));
+        if (lb) {
+            REQUIRE(lb->first == map_it->first);
+            REQUIRE(lb->second == map_it->second);
+        }
+    }
+
+    pgm::ConcurrentDynamicPGMIndex<uint32_t, uint32_t> empty(8, 0, 0, max_sealed_buffers);
+    REQUIRE(empty.empty());
+    REQUIRE_FALSE(empty.lower_bound(0).has_value());
+    empty.insert_or_assign(1, 2);
+    REQUIRE(empty.find(1) == 2u);
+    empty.erase(1);
+    REQUIRE(empty.empty());
 }
 
 #ifdef MORTON_ND_BMI2_ENABLED
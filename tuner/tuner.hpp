@@ -30,35 +30,8 @@
 #include <utility>
 #include <vector>
 
-#define PGM_IGNORED_PARAMETER 1
 #define PGM_EPSILON_RECURSIVE 4
 
-template<typename K>
-class MockPGMIndex : public pgm::PGMIndex<K, PGM_IGNORED_PARAMETER, PGM_EPSILON_RECURSIVE, double> {
-    size_t epsilon;
-
-public:
-
-    using segment_type = typename pgm::PGMIndex<K, PGM_IGNORED_PARAMETER, PGM_EPSILON_RECURSIVE, double>::Segment;
-
-    MockPGMIndex() = default;
-
-    MockPGMIndex(const std::vector<K> &data, size_t epsilon) : epsilon(epsilon) {
-        this->n = data.size();
-        this->first_key = data[0];
-        this->build(data.begin(), data.end(), epsilon, PGM_EPSILON_RECURSIVE, this->segments, this->levels_offsets);
-    }
-
-    pgm::ApproxPos search(const K &key) const {
-        auto k = std::max(this->first_key, key);
-        auto it = this->segment_for_key(k);
-        auto pos = std::min<size_t>((*it)(k), std::next(it)->intercept);
-        auto lo = PGM_SUB_EPS(pos, epsilon);
-        auto hi = PGM_ADD_EPS(pos, epsilon, this->n);
-        return {pos, lo, hi};
-    }
-};
-
 /*------- INDEX STATS -------*/
 
 struct IndexStats {
@@ -74,7 +47,7 @@ struct IndexStats {
     template<typename K>
     IndexStats(const std::vector<K> &data, const std::vector<K> &queries, size_t epsilon) : epsilon(epsilon) {
         auto start = timer::now();
-        MockPGMIndex<K> pgm(data, epsilon);
+        pgm::DynamicEpsilonPGMIndex<K, double> pgm(data, epsilon, PGM_EPSILON_RECURSIVE);
         auto end = timer::now();
         construction_ns = size_t(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
 
@@ -87,10 +60,7 @@ struct IndexStats {
 
             uint64_t cnt = 0;
             for (auto &q : queries) {
-                auto range = pgm.search(q);
-                auto lo = data.begin() + range.lo;
-                auto hi = data.begin() + range.hi;
-                cnt += std::distance(data.begin(), std::lower_bound(lo, hi, q));
+                cnt += std::distance(data.begin(), pgm.lower_bound_in(data.begin(), q));
             }
             [[maybe_unused]] volatile auto tmp = cnt;
 
@@ -262,7 +232,7 @@ void minimize_time_given_space(size_t max_space, double tolerance, const std::ve
             std::tie(a,b) = fit_segments_count_model(all_stats);
 
         if (guess_steps < guess_steps_threshold) {
-            auto constants = sizeof(typename MockPGMIndex<K>::segment_type);
+            auto constants = pgm::DynamicEpsilonPGMIndex<K, double>::segment_size_in_bytes();
 
             guess = size_t(guess_epsilon_space(100, a, -b, max_space, constants));
             guess = std::clamp(guess, lo + 1, hi - 1);